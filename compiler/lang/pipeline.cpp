@@ -37,13 +37,14 @@ struct DrainState {
   Value *hist;
 
   types::GenType *type;      // type of prefetch generator
+  unsigned stage;            // index of prefetch stage
   std::queue<Expr *> stages; // remaining pipeline stages
   std::queue<bool> parallel;
 
   DrainState()
       : states(nullptr), filled(nullptr), statesTemp(nullptr), pairs(nullptr),
         pairsTemp(nullptr), bufRef(nullptr), bufQer(nullptr), params(nullptr),
-        hist(nullptr), type(nullptr), stages(), parallel() {}
+        hist(nullptr), type(nullptr), stage(0), stages(), parallel() {}
 };
 
 struct seq::PipeExpr::PipelineCodegenState {
@@ -59,11 +60,14 @@ struct seq::PipeExpr::PipelineCodegenState {
 
   DrainState drain; // drain state for prefetch and inter-align optimizations
 
+  Value *stats;   // pipeline statistics handle, if enabled
+  unsigned stage; // index of next stage to codegen
+
   PipelineCodegenState(BasicBlock *block, std::queue<Expr *> stages,
                        std::queue<bool> parallel)
       : type(nullptr), val(nullptr), block(block), stages(std::move(stages)),
         parallel(), inParallel(false), inLoop(false), nestedParallel(false),
-        drain() {
+        drain(), stats(nullptr), stage(0) {
     int numParallels = 0;
     while (!parallel.empty()) {
       bool p = parallel.front();
@@ -79,6 +83,8 @@ struct seq::PipeExpr::PipelineCodegenState {
     PipelineCodegenState state(block, drain.stages, drain.parallel);
     state.val = val;
     state.type = type;
+    state.stats = stats;
+    state.stage = drain.stage + 1;
     return state;
   }
 };
@@ -181,8 +187,10 @@ static void applyRevCompOptimization(std::vector<Expr *> &stages,
 /*
  * Canonical k-mer optimization optimizes kmers |> canonical by using two
  * sliding windows to iterate over both forward and reverse k-mers
- * simultaneously. Currently only works with step=1 but probably possible to
- * support arbitrary step size.
+ * simultaneously, for any step size. Minimizers and syncmers are selected by
+ * their canonical form regardless, so a trailing canonical stage is folded
+ * into the sketching stage, which can then emit the canonical k-mer it
+ * already has.
  */
 static void applyCanonicalKmerOptimization(std::vector<Expr *> &stages,
                                            std::vector<bool> &parallel) {
@@ -194,22 +202,24 @@ static void applyCanonicalKmerOptimization(std::vector<Expr *> &stages,
       UnpackedStage f1(stages[i]);
       UnpackedStage f2(stages[i + 1]);
 
-      seq_int_t step = -1;
-      if (!f1.args.empty()) {
-        if (auto *e = dynamic_cast<IntExpr *>(f1.args[0]))
-          step = e->value();
-      }
-
       std::string replacement = "";
-      if (step == 1 && f1.matches("kmers", 1) && f2.matches("canonical"))
+      if (f1.matches("kmers", 1) && f2.matches("canonical"))
         replacement = "_kmers_canonical";
-      if (step == 1 && f1.matches("kmers_with_pos", 1) &&
-          f2.matches("canonical_with_pos"))
+      if (f1.matches("kmers_with_pos", 1) && f2.matches("canonical_with_pos"))
         replacement = "_kmers_canonical_with_pos";
+      if (f1.matches("minimizers", 1) && f2.matches("canonical"))
+        replacement = "_minimizers_canonical";
+      if (f1.matches("minimizers_with_pos", 1) &&
+          f2.matches("canonical_with_pos"))
+        replacement = "_minimizers_canonical_with_pos";
+      if (f1.matches("syncmers", 2) && f2.matches("canonical"))
+        replacement = "_syncmers_canonical";
+      if (f1.matches("syncmers_with_pos", 2) &&
+          f2.matches("canonical_with_pos"))
+        replacement = "_syncmers_canonical_with_pos";
 
       if (!replacement.empty()) {
-        stagesNew.push_back(
-            new FuncExpr(Func::getBuiltin(replacement), f1.func->getTypes()));
+        stagesNew.push_back(f1.repack(Func::getBuiltin(replacement)));
         stagesNew.back()->resolveTypes();
         parallelNew.push_back(parallel[i] || parallel[i + 1]);
         i += 2;
@@ -288,6 +298,137 @@ Value *PipeExpr::validateAndCodegenInterAlignParams(
   return params;
 }
 
+/*
+ * Pipeline statistics (enabled with "-pipestats") are collected by calls to
+ * the runtime's seq_pipe_* functions. Each call takes the pipeline's
+ * statistics handle, followed by the given arguments.
+ */
+static void codegenPipeStats(Value *stats, const std::string &name,
+                             std::vector<Value *> args, BasicBlock *block) {
+  if (!stats)
+    return;
+
+  LLVMContext &context = block->getContext();
+  Module *module = block->getModule();
+  std::vector<Type *> types = {IntegerType::getInt8PtrTy(context)};
+  for (Value *arg : args)
+    types.push_back(arg->getType());
+
+  auto *probe = cast<Function>(module->getOrInsertFunction(
+      "seq_pipe_" + name,
+      FunctionType::get(Type::getVoidTy(context), types, false)));
+  probe->setDoesNotThrow();
+  args.insert(args.begin(), stats);
+  IRBuilder<> builder(block);
+  builder.CreateCall(probe, args);
+}
+
+static void codegenPipeStats(Value *stats, const std::string &name,
+                             unsigned stage, BasicBlock *block) {
+  codegenPipeStats(stats, name,
+                   {ConstantInt::get(seqIntLLVM(block->getContext()), stage)},
+                   block);
+}
+
+/*
+ * Number of the prefetch coroutines states[from] to states[to - 1] that have
+ * not finished, for the occupancy reported in pipeline statistics; codegen
+ * continues in the returned block.
+ */
+static Value *codegenLiveCount(types::GenType *genType, Value *states,
+                               Value *from, Value *to, BasicBlock *&block) {
+  LLVMContext &context = block->getContext();
+  Function *func = block->getParent();
+  IRBuilder<> builder(block);
+  BasicBlock *loop = BasicBlock::Create(context, "live_count", func);
+  BasicBlock *body = BasicBlock::Create(context, "live_count_body", func);
+  BasicBlock *exit = BasicBlock::Create(context, "live_count_exit", func);
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(loop);
+  PHINode *i = builder.CreatePHI(seqIntLLVM(context), 2);
+  PHINode *live = builder.CreatePHI(seqIntLLVM(context), 2);
+  i->addIncoming(from, block);
+  live->addIncoming(zeroLLVM(context), block);
+  builder.CreateCondBr(builder.CreateICmpSLT(i, to), body, exit);
+
+  builder.SetInsertPoint(body);
+  Value *gen = builder.CreateLoad(builder.CreateGEP(states, i));
+  Value *done = genType->done(gen, body);
+  builder.SetInsertPoint(body);
+  Value *notDone =
+      builder.CreateZExt(builder.CreateNot(done), seqIntLLVM(context));
+  i->addIncoming(builder.CreateAdd(i, oneLLVM(context)), body);
+  live->addIncoming(builder.CreateAdd(live, notDone), body);
+  builder.CreateBr(loop);
+
+  block = exit;
+  return live;
+}
+
+/*
+ * The statistics handle of a pipeline is looked up by the runtime the first
+ * time the pipeline runs, and kept in a global from then on, so that later
+ * runs neither lock nor search the runtime's list of pipelines. Threads that
+ * race on the first run get the same handle back.
+ */
+static Value *codegenPipeStatsInit(const std::vector<Expr *> &stages,
+                                   const SrcInfo &src, BasicBlock *&block) {
+  LLVMContext &context = block->getContext();
+  Module *module = block->getModule();
+  Function *func = block->getParent();
+  IRBuilder<> builder(block);
+
+  std::vector<Constant *> names;
+  for (Expr *stage : stages) {
+    UnpackedStage unpacked(stage);
+    Func *f = unpacked.func ? dynamic_cast<Func *>(unpacked.func->getFunc())
+                            : nullptr;
+    names.push_back(cast<Constant>(
+        builder.CreateGlobalStringPtr(f ? f->genericName() : "<expr>")));
+  }
+  auto *namesType = ArrayType::get(builder.getInt8PtrTy(), names.size());
+  auto *namesVar = new GlobalVariable(
+      *module, namesType, true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(namesType, names), "pipe.stages");
+
+  auto *handleVar = new GlobalVariable(
+      *module, builder.getInt8PtrTy(), false, GlobalValue::PrivateLinkage,
+      ConstantPointerNull::get(builder.getInt8PtrTy()), "pipe.stats");
+  handleVar->setAlignment(sizeof(void *));
+  LoadInst *cached = builder.CreateLoad(handleVar);
+  cached->setAlignment(sizeof(void *));
+  cached->setAtomic(AtomicOrdering::Acquire);
+
+  BasicBlock *resolve = BasicBlock::Create(context, "pipe_stats_init", func);
+  BasicBlock *resolved = BasicBlock::Create(context, "pipe_stats", func);
+  builder.CreateCondBr(builder.CreateIsNull(cached), resolve, resolved);
+
+  const std::string id = src.file.substr(src.file.rfind('/') + 1) + ":" +
+                         std::to_string(src.line) + ":" +
+                         std::to_string(src.col);
+  auto *init = cast<Function>(module->getOrInsertFunction(
+      "seq_pipe_stats", builder.getInt8PtrTy(), builder.getInt8PtrTy(),
+      builder.getInt8PtrTy()->getPointerTo(), seqIntLLVM(context)));
+  init->setDoesNotThrow();
+  builder.SetInsertPoint(resolve);
+  Value *stats = builder.CreateCall(
+      init, {builder.CreateGlobalStringPtr(id),
+             builder.CreateConstInBoundsGEP2_64(namesVar, 0, 0),
+             ConstantInt::get(seqIntLLVM(context), stages.size())});
+  StoreInst *store = builder.CreateStore(stats, handleVar);
+  store->setAlignment(sizeof(void *));
+  store->setAtomic(AtomicOrdering::Release);
+  builder.CreateBr(resolved);
+
+  builder.SetInsertPoint(resolved);
+  PHINode *handle = builder.CreatePHI(builder.getInt8PtrTy(), 2);
+  handle->addIncoming(cached, block);
+  handle->addIncoming(stats, resolve);
+  block = resolved;
+  return handle;
+}
+
 Value *PipeExpr::codegenPipe(BaseFunc *base,
                              PipeExpr::PipelineCodegenState &state) {
   assert(state.stages.size() == state.parallel.size());
@@ -301,6 +442,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
 
   Expr *stage = state.stages.front();
   bool parallelize = state.parallel.front();
+  const unsigned idx = state.stage++;
   state.stages.pop();
   state.parallel.pop();
 
@@ -309,6 +451,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
 
   if (!state.val) {
     assert(!state.type);
+    codegenPipeStats(state.stats, "stage", idx, state.block);
     state.type = stage->getType();
     state.val = stage->codegen(base, state.block);
   } else {
@@ -319,6 +462,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     call.setTryCatch(tc);
     state.type = call.getType();
     types::GenType *genType = state.type->asGen();
+    codegenPipeStats(state.stats, "stage", idx, state.block);
 
     if (!(genType && (genType->fromPrefetch() || genType->fromInterAlign()))) {
       state.val = call.codegen(base, state.block);
@@ -385,6 +529,14 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     Value *nextVal = builder.CreateLoad(next);
     slot = builder.CreateGEP(states, nextVal);
     Value *gen = builder.CreateLoad(slot);
+    codegenPipeStats(state.stats, "resume", idx, full);
+    if (state.stats) {
+      Value *live =
+          codegenLiveCount(genType, states, zeroLLVM(context), M, full);
+      codegenPipeStats(state.stats, "batch",
+                       {ConstantInt::get(seqIntLLVM(context), idx), live, M},
+                       full);
+    }
 
     if (tc) {
       BasicBlock *normal = BasicBlock::Create(context, "normal", func);
@@ -404,11 +556,13 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     state.type = genType->getBaseType(0);
     state.val =
         state.type->is(types::Void) ? nullptr : genType->promise(gen, genDone);
+    codegenPipeStats(state.stats, "yield", idx, genDone);
 
     // store the current state for the drain step:
     state.drain.states = states;
     state.drain.filled = filled;
     state.drain.type = genType;
+    state.drain.stage = idx;
     state.drain.stages = state.stages;
     state.drain.parallel = state.parallel;
 
@@ -518,6 +672,15 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     Value *cond = builder.CreateICmpSLT(N, M);
     builder.CreateCondBr(cond, notFull0, full);
 
+    if (state.stats) {
+      builder.SetInsertPoint(full);
+      Value *Ncur = builder.CreateLoad(filled);
+      codegenPipeStats(state.stats, "resume", idx, full);
+      codegenPipeStats(state.stats, "batch",
+                       {ConstantInt::get(seqIntLLVM(context), idx), Ncur, M},
+                       full);
+    }
+
     builder.SetInsertPoint(full);
     N = builder.CreateCall(flush, {pairs, bufRef, bufQer, states, N, params,
                                    hist, pairsTemp, statesTemp});
@@ -536,6 +699,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     state.drain.params = params;
     state.drain.hist = hist;
     state.drain.type = genType;
+    state.drain.stage = idx;
     state.drain.stages = state.stages;
     state.drain.parallel = state.parallel;
 
@@ -557,6 +721,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     BasicBlock *loop = BasicBlock::Create(context, "pipe", func);
     BasicBlock *loop0 = loop;
     builder.CreateBr(loop);
+    codegenPipeStats(state.stats, "resume", idx, loop);
 
     if (tc) {
       BasicBlock *normal = BasicBlock::Create(context, "normal", func);
@@ -578,6 +743,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     state.val = state.type->is(types::Void)
                     ? nullptr
                     : genType->promise(gen, state.block);
+    codegenPipeStats(state.stats, "yield", idx, state.block);
 
 #if SEQ_HAS_TAPIR
     if (parallelize) {
@@ -589,6 +755,7 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
       else
         builder.CreateDetach(detach, loop0, syncReg);
       state.block = detach;
+      codegenPipeStats(state.stats, "start", {}, state.block);
     }
 #endif
 
@@ -604,6 +771,11 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     state.inLoop = oldInLoop;
     state.inParallel = oldInParallel;
 
+#if SEQ_HAS_TAPIR
+    if (parallelize)
+      codegenPipeStats(state.stats, "stop", {}, state.block);
+#endif
+
     builder.SetInsertPoint(state.block);
 
 #if SEQ_HAS_TAPIR
@@ -626,6 +798,8 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
     /*
      * Simple function -- just a plain call
      */
+    codegenPipeStats(state.stats, "yield", idx, state.block);
+
 #if SEQ_HAS_TAPIR
     if (parallelize) {
       if (!state.inLoop)
@@ -645,9 +819,11 @@ Value *PipeExpr::codegenPipe(BaseFunc *base,
       bool oldInParallel = state.inParallel;
       state.inParallel = true;
       state.block = detach;
+      codegenPipeStats(state.stats, "start", {}, state.block);
       codegenPipe(base, state);
       state.inParallel = oldInParallel;
 
+      codegenPipeStats(state.stats, "stop", {}, state.block);
       builder.SetInsertPoint(state.block);
       builder.CreateReattach(cont, syncReg);
 
@@ -720,6 +896,12 @@ Value *PipeExpr::codegen0(BaseFunc *base, BasicBlock *&block) {
 
   TryCatch *tc = getTryCatch();
   PipeExpr::PipelineCodegenState state(block, queue, parallelQueue);
+  if (config::config().pipelineStats) {
+    state.stats = codegenPipeStatsInit(stages, getSrcInfo(), state.block);
+    codegenPipeStats(state.stats, "start", {}, state.block);
+    block = state.block;
+  }
+  const unsigned drainIdx = stages.size();
 
 #if SEQ_HAS_TAPIR
   // If we have nested parallelism, make sure we use a task group
@@ -795,6 +977,18 @@ Value *PipeExpr::codegen0(BaseFunc *base, BasicBlock *&block) {
 
       builder.SetInsertPoint(notDone);
       builder.CreateBr(notDoneLoop);
+      codegenPipeStats(state.stats, "resume", drainIdx, notDoneLoop);
+      if (state.stats) {
+        // the coroutines left to drain, including this one
+        Value *live =
+            codegenLiveCount(genType, states, control, N, notDoneLoop);
+        codegenPipeStats(
+            state.stats, "batch",
+            {ConstantInt::get(seqIntLLVM(context), drain.stage), live,
+             ConstantInt::get(seqIntLLVM(context),
+                              PipeExpr::SCHED_WIDTH_PREFETCH)},
+            notDoneLoop);
+      }
 
       if (tc) {
         BasicBlock *normal = BasicBlock::Create(context, "normal", func);
@@ -811,6 +1005,7 @@ Value *PipeExpr::codegen0(BaseFunc *base, BasicBlock *&block) {
       builder.CreateCondBr(done, finalize, notDoneLoop0);
 
       Value *val = genType->promise(gen, finalize);
+      codegenPipeStats(state.stats, "yield", drain.stage, finalize);
       PipeExpr::PipelineCodegenState drainState =
           state.getDrainState(val, genType->getBaseType(0), finalize);
       codegenPipe(base, drainState);
@@ -831,6 +1026,16 @@ Value *PipeExpr::codegen0(BaseFunc *base, BasicBlock *&block) {
 
       builder.SetInsertPoint(loop);
       Value *Nnew = builder.CreateLoad(filled);
+      if (state.stats) {
+        codegenPipeStats(state.stats, "resume", drainIdx, loop);
+        codegenPipeStats(
+            state.stats, "batch",
+            {ConstantInt::get(seqIntLLVM(context), drain.stage), Nnew,
+             ConstantInt::get(seqIntLLVM(context),
+                              PipeExpr::SCHED_WIDTH_INTERALIGN)},
+            loop);
+      }
+      builder.SetInsertPoint(loop);
       N = builder.CreateCall(flush, {drain.pairs, drain.bufRef, drain.bufQer,
                                      states, Nnew, drain.params, drain.hist,
                                      drain.pairsTemp, drain.statesTemp});
@@ -856,6 +1061,8 @@ Value *PipeExpr::codegen0(BaseFunc *base, BasicBlock *&block) {
   }
 #endif
 
+  codegenPipeStats(state.stats, "stop", {}, block);
+
   // connect entry block:
   builder.SetInsertPoint(entry);
   builder.CreateBr(start);
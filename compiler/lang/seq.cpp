@@ -1,9 +1,14 @@
 #include "lang/seq.h"
 #include "parser/common.h"
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <system_error>
+#include <thread>
 
 using namespace seq;
 using namespace llvm;
@@ -15,7 +20,9 @@ using namespace llvm::orc;
 #include "llvm/CodeGen/CommandFlags.def"
 #endif
 
-config::Config::Config() : context(), debug(false), profile(false) {}
+config::Config::Config()
+    : context(), debug(false), profile(false), codegenThreads(1),
+      tiered(false), pipelineStats(false) {}
 
 config::Config &seq::config::config() {
   static Config config;
@@ -325,7 +332,55 @@ static void applyGCTransformations(Module *module) {
   }
 }
 
-static void optimizeModule(Module *module) {
+/*
+ * Inserts calls to the runtime profiler on entry to and exit from each
+ * function. This runs after optimization, so that coroutines have already been
+ * split into their resume/destroy parts.
+ */
+static void applyProfileTransformations(Module *module) {
+  if (!config::config().profile)
+    return;
+  LLVMContext &context = module->getContext();
+  auto *enter = cast<Function>(module->getOrInsertFunction(
+      "seq_prof_enter", Type::getVoidTy(context),
+      IntegerType::getInt8PtrTy(context)));
+  auto *exit = cast<Function>(module->getOrInsertFunction(
+      "seq_prof_exit", Type::getVoidTy(context),
+      IntegerType::getInt8PtrTy(context)));
+  enter->setDoesNotThrow();
+  exit->setDoesNotThrow();
+
+  IRBuilder<> builder(context);
+  for (Function &f : *module) {
+    if (f.isDeclaration())
+      continue;
+
+    builder.SetInsertPoint(&*f.getEntryBlock().getFirstInsertionPt());
+    Value *name = builder.CreateGlobalStringPtr(f.getName(), "prof.name");
+    builder.CreateCall(enter, name);
+
+    for (BasicBlock &block : f.getBasicBlockList()) {
+      Instruction *term = block.getTerminator();
+      if (!term || !(isa<ReturnInst>(term) || isa<ResumeInst>(term)))
+        continue;
+      // a musttail call has to immediately precede its return (save for
+      // an optional bitcast)
+      Instruction *pos = term;
+      Instruction *prev = term->getPrevNode();
+      if (prev && isa<BitCastInst>(prev))
+        prev = prev->getPrevNode();
+      if (auto *call = dyn_cast_or_null<CallInst>(prev)) {
+        if (call->isMustTailCall())
+          pos = call;
+      }
+      builder.SetInsertPoint(pos);
+      builder.CreateCall(exit, name);
+    }
+  }
+}
+
+static void optimizeModule(Module *module, bool lowerTapir = true,
+                           unsigned optLevel = 3) {
   const bool debug = config::config().debug;
   applyDebugTransformations(module);
   std::unique_ptr<legacy::PassManager> pm(new legacy::PassManager());
@@ -358,13 +413,13 @@ static void optimizeModule(Module *module) {
     pm->add(tpc);
   }
 
-  unsigned optLevel = 3;
   unsigned sizeLevel = 0;
   PassManagerBuilder builder;
 
 #if SEQ_HAS_TAPIR
   static OpenMPABI omp;
-  builder.tapirTarget = &omp;
+  if (lowerTapir)
+    builder.tapirTarget = &omp;
 #endif
 
   if (!debug) {
@@ -394,14 +449,21 @@ static void optimizeModule(Module *module) {
 
 void SeqModule::optimize() { optimizeModule(module); }
 
-void SeqModule::runCodegenPipeline() {
+void SeqModule::runCodegenPipeline(bool finalOptimize, unsigned optLevel,
+                                   bool profileHooks) {
   codegen(module);
   verify();
-  optimize();
+  optimizeModule(module, /*lowerTapir=*/true, optLevel);
   applyGCTransformations(module);
   verify();
-  optimize();
-  verify();
+  if (finalOptimize) {
+    optimizeModule(module, /*lowerTapir=*/true, optLevel);
+    verify();
+  }
+  if (profileHooks) {
+    applyProfileTransformations(module);
+    verify();
+  }
 #if SEQ_HAS_TAPIR
   tapir::resetOMPABI();
 #endif
@@ -461,14 +523,370 @@ public:
     }
   }
 };
+
+using ObjectFileOwner = object::OwningBinary<object::ObjectFile>;
+} // namespace
+
+/*
+ * Parallel code generation
+ *
+ * The first optimization round runs on the whole module, since inlining,
+ * coroutine splitting and Tapir lowering all need to see the entire program.
+ * After that, the module is split into partitions which are serialized to
+ * bitcode, then re-optimized and compiled to object code on separate threads,
+ * each with its own LLVMContext. The resulting objects are linked by the JIT.
+ */
+
+// fewest defined functions per partition; below this, splitting costs more
+// than it saves
+static const unsigned MIN_PARTITION_SIZE = 64;
+
+static std::string writeBitcode(Module *module) {
+  std::string bitcode;
+  raw_string_ostream stream(bitcode);
+#if LLVM_VERSION_MAJOR >= 7
+  WriteBitcodeToFile(*module, stream);
+#else
+  WriteBitcodeToFile(module, stream);
+#endif
+  return stream.str();
+}
+
+static ObjectFileOwner emitObject(Module *module) {
+  std::unique_ptr<TargetMachine> machine(
+      getTargetMachine(Triple(module->getTargetTriple()), getCPUStr(),
+                       getFeaturesStr(), InitTargetOptionsFromCodeGenFlags()));
+  assert(machine);
+
+  SmallVector<char, 0> obj;
+  {
+    raw_svector_ostream stream(obj);
+    legacy::PassManager pm;
+    MCContext *ctx;
+    if (machine->addPassesToEmitMC(pm, ctx, stream))
+      assert(0 && "target does not support MC emission");
+    pm.run(*module);
+  }
+
+  std::unique_ptr<MemoryBuffer> buffer = MemoryBuffer::getMemBufferCopy(
+      StringRef(obj.data(), obj.size()), module->getName());
+  auto file = cantFail(
+      object::ObjectFile::createObjectFile(buffer->getMemBufferRef()));
+  return ObjectFileOwner(std::move(file), std::move(buffer));
+}
+
+static ObjectFileOwner compilePartition(const std::string &bitcode) {
+  LLVMContext context;
+  std::unique_ptr<Module> module = cantFail(
+      parseBitcodeFile(MemoryBufferRef(bitcode, "seq.part"), context));
+
+  // Tapir constructs were lowered by the whole-module round; profiling hooks
+  // go in after this partition's final optimization, as in the serial path
+  optimizeModule(module.get(), /*lowerTapir=*/false);
+  applyProfileTransformations(module.get());
+  verifyModuleFailFast(*module);
+  return emitObject(module.get());
+}
+
+static std::vector<ObjectFileOwner>
+compilePartitions(std::unique_ptr<Module> module, unsigned threads) {
+  unsigned numFuncs = 0;
+  for (Function &f : *module) {
+    if (!f.isDeclaration())
+      ++numFuncs;
+  }
+  const unsigned numParts =
+      std::max(1u, std::min(threads, numFuncs / MIN_PARTITION_SIZE));
+
+  // partitions share the original context, so serialize them before handing
+  // them off to worker threads
+  std::vector<std::string> bitcodes;
+  SplitModule(std::move(module), numParts, [&](std::unique_ptr<Module> part) {
+    bitcodes.push_back(writeBitcode(part.get()));
+  });
+
+  std::vector<ObjectFileOwner> objects(bitcodes.size());
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < bitcodes.size(); i++) {
+    workers.emplace_back([&bitcodes, &objects, i]() {
+      objects[i] = compilePartition(bitcodes[i]);
+    });
+  }
+  for (auto &worker : workers)
+    worker.join();
+  return objects;
+}
+
+/*
+ * Tiered execution
+ *
+ * The program is first compiled at a low optimization level so it can start
+ * running right away. Each directly-called function gets an entry counter, and
+ * direct calls are routed through a table of function pointers. A background
+ * thread watches the counters, recompiles functions that become hot at the
+ * highest optimization level and patches their table entries to point to the
+ * new code. Code that is already running (e.g. a loop in the program's main
+ * body) keeps running at the lower level. Recompiles run off the main thread
+ * in their own context; only linking the result into the engine takes a lock,
+ * which the main thread also takes before tearing the engine down.
+ */
+static const unsigned TIER_BASE_OPT_LEVEL = 1;
+static const unsigned TIER_HOT_OPT_LEVEL = 3;
+static const uint64_t TIER_HOT_THRESHOLD = 10000;
+static const unsigned TIER_POLL_INTERVAL_MS = 10;
+
+namespace {
+class TierUpCompiler {
+private:
+  /// State shared with the background thread, which can outlive the compiler
+  /// once stopped (see stop())
+  struct State {
+    /// Guards everything that goes away with the engine: the engine itself
+    /// and the counters and table in JIT'd memory
+    std::mutex lock;
+    std::condition_variable wake;
+    bool done;
+
+    /// Engine running the base-level code
+    ExecutionEngine *eng;
+
+    /// Module after base-level optimization, before instrumentation
+    std::string bitcode;
+
+    /// Names of swappable functions, indexed like the table below
+    std::vector<std::string> names;
+
+    /// Whether each function was (or is being) recompiled already
+    std::vector<bool> promoted;
+
+    /// Entry counters and call table in JIT'd memory
+    uint64_t *counters;
+    uint64_t *table;
+
+    State()
+        : lock(), wake(), done(false), eng(nullptr), bitcode(), names(),
+          promoted(), counters(nullptr), table(nullptr) {}
+  };
+
+  std::shared_ptr<State> state;
+  std::thread worker;
+
+  /// Builds an object file with the given functions at the highest level.
+  /// Runs without the lock: it only reads the bitcode and names, which are
+  /// fixed once the worker starts.
+  static ObjectFileOwner compile(const State &state,
+                                 const std::vector<unsigned> &hot) {
+    LLVMContext context;
+    std::unique_ptr<Module> module = cantFail(
+        parseBitcodeFile(MemoryBufferRef(state.bitcode, "seq.tier"), context));
+
+    // data is shared with the running program rather than duplicated, and
+    // static constructors must not run again
+    std::vector<GlobalVariable *> special;
+    for (GlobalVariable &g : module->globals()) {
+      if (g.getName().startswith("llvm.")) {
+        special.push_back(&g);
+      } else if (g.hasInitializer()) {
+        g.setInitializer(nullptr);
+        g.setLinkage(GlobalValue::ExternalLinkage);
+        g.setDSOLocal(false);
+      }
+    }
+    for (GlobalVariable *g : special)
+      g->eraseFromParent();
+
+    // hot functions are exported under a new name; everything else becomes
+    // a private copy that can be inlined into them
+    std::set<std::string> hotNames;
+    for (unsigned i : hot)
+      hotNames.insert(state.names[i]);
+    for (Function &f : *module) {
+      if (f.isDeclaration())
+        continue;
+      if (hotNames.find(f.getName().str()) != hotNames.end())
+        f.setName(f.getName() + ".tier");
+      else
+        f.setLinkage(GlobalValue::InternalLinkage);
+    }
+
+    // Tapir constructs were lowered by the base-level round
+    optimizeModule(module.get(), /*lowerTapir=*/false, TIER_HOT_OPT_LEVEL);
+    verifyModuleFailFast(*module);
+    return emitObject(module.get());
+  }
+
+  static void run(std::shared_ptr<State> state) {
+    std::unique_lock<std::mutex> l(state->lock);
+    for (;;) {
+      state->wake.wait_for(l, std::chrono::milliseconds(TIER_POLL_INTERVAL_MS),
+                           [&state] { return state->done; });
+      if (state->done)
+        return;
+
+      std::vector<unsigned> hot;
+      for (unsigned i = 0; i < state->names.size(); i++) {
+        if (!state->promoted[i] &&
+            __atomic_load_n(&state->counters[i], __ATOMIC_RELAXED) >=
+                TIER_HOT_THRESHOLD) {
+          state->promoted[i] = true;
+          hot.push_back(i);
+        }
+      }
+      if (hot.empty())
+        continue;
+
+      l.unlock();
+      ObjectFileOwner object = compile(*state, hot);
+      l.lock();
+      // the program may have finished while we were compiling, in which
+      // case the engine is gone
+      if (state->done)
+        return;
+
+      state->eng->addObjectFile(std::move(object));
+      for (unsigned i : hot) {
+        uint64_t addr =
+            state->eng->getFunctionAddress(state->names[i] + ".tier");
+        assert(addr);
+        __atomic_store_n(&state->table[i], addr, __ATOMIC_RELEASE);
+      }
+    }
+  }
+
+public:
+  TierUpCompiler() : state(std::make_shared<State>()), worker() {}
+
+  ~TierUpCompiler() { stop(); }
+  /// Adds entry counters to the given (base-level optimized) module and
+  /// routes direct calls through the call table. Must be called before the
+  /// module is handed to the execution engine.
+  void instrument(Module *module) {
+    LLVMContext &context = module->getContext();
+
+    // recompiled code refers to everything by name
+    unsigned anon = 0;
+    for (GlobalVariable &g : module->globals()) {
+      if (!g.hasName())
+        g.setName("seq.tier.anon." + std::to_string(anon++));
+      if (g.hasLocalLinkage())
+        g.setLinkage(GlobalValue::ExternalLinkage);
+    }
+
+    std::vector<Function *> funcs;
+    for (Function &f : *module) {
+      if (f.isDeclaration())
+        continue;
+      if (!f.hasName())
+        f.setName("seq.tier.anon." + std::to_string(anon++));
+      if (f.hasLocalLinkage())
+        f.setLinkage(GlobalValue::ExternalLinkage);
+
+      // only functions that are called directly can be swapped out
+      for (User *user : f.users()) {
+        CallSite call(user);
+        if (call && call.getCalledValue() == &f) {
+          funcs.push_back(&f);
+          break;
+        }
+      }
+    }
+
+    state->bitcode = writeBitcode(module);
+    if (funcs.empty())
+      return;
+
+    Type *ptrType = Type::getInt8PtrTy(context);
+    Type *counterType = Type::getInt64Ty(context);
+    auto *tableType = ArrayType::get(ptrType, funcs.size());
+    auto *countersType = ArrayType::get(counterType, funcs.size());
+
+    std::vector<Constant *> entries;
+    for (Function *f : funcs)
+      entries.push_back(ConstantExpr::getBitCast(f, ptrType));
+    auto *tableVar = new GlobalVariable(
+        *module, tableType, false, GlobalValue::ExternalLinkage,
+        ConstantArray::get(tableType, entries), "seq.tier.table");
+    auto *countersVar = new GlobalVariable(
+        *module, countersType, false, GlobalValue::ExternalLinkage,
+        Constant::getNullValue(countersType), "seq.tier.counters");
+
+    IRBuilder<> builder(context);
+    for (unsigned i = 0; i < funcs.size(); i++) {
+      Function *f = funcs[i];
+      state->names.push_back(f->getName().str());
+
+      builder.SetInsertPoint(&*f->getEntryBlock().getFirstInsertionPt());
+      Value *counter = builder.CreateConstInBoundsGEP2_64(countersVar, 0, i);
+      LoadInst *count = builder.CreateLoad(counter);
+      count->setAtomic(AtomicOrdering::Monotonic);
+      count->setAlignment(8);
+      StoreInst *store =
+          builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)),
+                              counter);
+      store->setAtomic(AtomicOrdering::Monotonic);
+      store->setAlignment(8);
+
+      std::vector<User *> users(f->user_begin(), f->user_end());
+      for (User *user : users) {
+        CallSite call(user);
+        if (!call || call.getCalledValue() != f)
+          continue;
+        builder.SetInsertPoint(call.getInstruction());
+        Value *slot = builder.CreateConstInBoundsGEP2_64(tableVar, 0, i);
+        LoadInst *target = builder.CreateLoad(slot);
+        target->setAtomic(AtomicOrdering::Monotonic);
+        target->setAlignment(8);
+        call.setCalledFunction(builder.CreateBitCast(target, f->getType()));
+      }
+    }
+
+    state->promoted.resize(state->names.size(), false);
+    verifyModuleFailFast(*module);
+  }
+
+  /// Starts watching entry counters. Must be called after the engine was
+  /// created, and before the program starts running. From then on, the
+  /// engine may only be used under the state's lock, until stop().
+  void start(ExecutionEngine *eng) {
+    if (state->names.empty())
+      return;
+    state->eng = eng;
+    state->counters =
+        (uint64_t *)eng->getGlobalValueAddress("seq.tier.counters");
+    state->table = (uint64_t *)eng->getGlobalValueAddress("seq.tier.table");
+    assert(state->counters && state->table);
+    worker = std::thread(&TierUpCompiler::run, state);
+  }
+
+  /// Stops watching entry counters; the engine can be deleted afterwards. A
+  /// recompile that is still in progress is abandoned rather than waited for:
+  /// the worker drops its result and exits once the compile is done.
+  void stop() {
+    if (!worker.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> l(state->lock);
+      state->done = true;
+    }
+    state->wake.notify_all();
+    worker.detach();
+  }
+};
 } // namespace
 
 void SeqModule::execute(const std::vector<std::string> &args,
                         const std::vector<std::string> &libs) {
   const bool debug = config::config().debug;
-  runCodegenPipeline();
+  const bool symbolize = debug || config::config().profile;
+  const bool tiered = config::config().tiered && !debug;
+  const bool parallel = !tiered && config::config().codegenThreads > 1;
+  if (tiered)
+    runCodegenPipeline(/*finalOptimize=*/false, TIER_BASE_OPT_LEVEL);
+  else
+    runCodegenPipeline(/*finalOptimize=*/!parallel, /*optLevel=*/3,
+                       /*profileHooks=*/!parallel);
   std::vector<std::string> functionNames;
-  if (debug) {
+  if (symbolize) {
     for (Function &f : *module) {
       functionNames.push_back(f.getName());
     }
@@ -476,15 +894,37 @@ void SeqModule::execute(const std::vector<std::string> &args,
 
   std::unique_ptr<Module> owner(module);
   module = nullptr;
+
+  TierUpCompiler tierUp;
+  if (tiered)
+    tierUp.instrument(owner.get());
+
+  std::vector<ObjectFileOwner> objects;
+  if (parallel) {
+    auto stub = make_unique<Module>("seq.stub", owner->getContext());
+    stub->setTargetTriple(owner->getTargetTriple());
+    stub->setDataLayout(owner->getDataLayout());
+    objects =
+        compilePartitions(std::move(owner), config::config().codegenThreads);
+    owner = std::move(stub);
+    func = nullptr;
+  }
+
   EngineBuilder EB(std::move(owner));
   EB.setMCJITMemoryManager(make_unique<BoehmGCMemoryManager>());
   EB.setUseOrcMCJITReplacement(true);
   ExecutionEngine *eng = EB.create();
 
-  assert(initFunc);
-  assert(strlenFunc);
-  eng->addGlobalMapping(initFunc, (void *)seq_init);
-  eng->addGlobalMapping(strlenFunc, (void *)strlen);
+  if (parallel) {
+    // runtime symbols are resolved in-process when the objects are linked
+    for (auto &object : objects)
+      eng->addObjectFile(std::move(object));
+  } else {
+    assert(initFunc);
+    assert(strlenFunc);
+    eng->addGlobalMapping(initFunc, (void *)seq_init);
+    eng->addGlobalMapping(strlenFunc, (void *)strlen);
+  }
 
   std::string err;
   for (auto &lib : libs) {
@@ -494,7 +934,7 @@ void SeqModule::execute(const std::vector<std::string> &args,
     }
   }
 
-  if (debug) {
+  if (symbolize) {
     for (const std::string &name : functionNames) {
       void *addr =
           eng->getPointerToNamedFunction(name, /*AbortOnFailure=*/false);
@@ -503,7 +943,21 @@ void SeqModule::execute(const std::vector<std::string> &args,
     }
   }
 
-  eng->runFunctionAsMain(func, args, nullptr);
+  if (tiered)
+    tierUp.start(eng);
+
+  if (func) {
+    eng->runFunctionAsMain(func, args, nullptr);
+  } else {
+    auto *mainFunc = (int (*)(int, char **))eng->getFunctionAddress("main");
+    assert(mainFunc);
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    mainFunc((int)args.size(), argv.data());
+  }
+  tierUp.stop();
   delete eng;
 }
 
@@ -521,22 +975,83 @@ void tapir::resetOMPABI() {
  * JIT
  */
 #if LLVM_VERSION_MAJOR == 6
-static std::shared_ptr<Module> optimizeModule(std::shared_ptr<Module> module) {
-  optimizeModule(module.get());
+static std::shared_ptr<Module> optimizeModule(std::shared_ptr<Module> module,
+                                              unsigned optLevel) {
+  optimizeModule(module.get(), /*lowerTapir=*/true, optLevel);
   verifyModuleFailFast(*module);
   return module;
 }
 
+/*
+ * Incremental compilation
+ *
+ * Most functions realized by one input are needed again by later ones (e.g.
+ * anything pulled in from the standard library), so instead of re-optimizing
+ * and re-compiling them every time, we remember what was already compiled and
+ * drop the bodies of unchanged functions from new modules. Compiled functions
+ * are called through indirect stubs, which lets us swap in a new definition
+ * when a function changes, or a more optimized one once it has become hot.
+ * Inputs are first compiled at a lower optimization level, since most of their
+ * code only ever runs once. Compiled functions count their calls; one that was
+ * called often enough is recompiled at the highest level, on its own, the next
+ * time an input needs it.
+ */
+static const unsigned JIT_BASE_OPT_LEVEL = 1;
+static const unsigned JIT_HOT_OPT_LEVEL = 3;
+static const uint64_t JIT_HOT_THRESHOLD = 10000;
+
+// boost's hash_combine; unlike a sum, it depends on the order of its inputs
+static void hashCombine(size_t &seed, size_t hash) {
+  seed ^= hash + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+// makes f count its calls in the given slot, which outlives the JIT'd code
+static void countCalls(Function *f, uint64_t *slot) {
+  LLVMContext &context = f->getContext();
+  IRBuilder<> builder(&*f->getEntryBlock().getFirstInsertionPt());
+  Value *counter = builder.CreateIntToPtr(
+      ConstantInt::get(Type::getInt64Ty(context), (uint64_t)slot),
+      Type::getInt64PtrTy(context));
+  LoadInst *count = builder.CreateLoad(counter);
+  count->setAtomic(AtomicOrdering::Monotonic);
+  count->setAlignment(8);
+  StoreInst *store =
+      builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)),
+                          counter);
+  store->setAtomic(AtomicOrdering::Monotonic);
+  store->setAlignment(8);
+}
+
+static void collectRefs(Value *val, std::vector<GlobalValue *> &refs,
+                        std::set<Value *> &seen) {
+  if (!isa<Constant>(val) || !seen.insert(val).second)
+    return;
+
+  if (auto *g = dyn_cast<GlobalValue>(val)) {
+    refs.push_back(g);
+    auto *var = dyn_cast<GlobalVariable>(g);
+    if (var && var->hasLocalLinkage() && var->hasInitializer())
+      collectRefs(var->getInitializer(), refs, seen);
+    return;
+  }
+
+  for (Value *op : cast<Constant>(val)->operands())
+    collectRefs(op, refs, seen);
+}
+
 SeqJIT::SeqJIT()
     : target(EngineBuilder().selectTarget()),
       layout(target->createDataLayout()),
       objLayer([]() { return std::make_shared<BoehmGCMemoryManager>(); }),
       comLayer(objLayer, SimpleCompiler(*target)),
       optLayer(comLayer,
-               [](std::shared_ptr<Module> M) {
-                 return optimizeModule(std::move(M));
+               [this](std::shared_ptr<Module> M) {
+                 return optimizeModule(std::move(M), optLevel);
                }),
-      globals(), inputNum(0) {
+      stubs(
+          createLocalIndirectStubsManagerBuilder(target->getTargetTriple())()),
+      cache(), callCounts(), globals(), stats(), optLevel(JIT_BASE_OPT_LEVEL),
+      inputNum(0) {
   sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
 }
 
@@ -556,6 +1071,8 @@ std::unique_ptr<Module> SeqJIT::makeModule() {
 SeqJIT::ModuleHandle SeqJIT::addModule(std::unique_ptr<Module> module) {
   auto resolver = createLambdaResolver(
       [&](const std::string &name) {
+        if (auto sym = stubs->findStub(name, false))
+          return sym;
         if (auto sym = optLayer.findSymbol(name, false))
           return sym;
         return JITSymbol(nullptr);
@@ -568,11 +1085,15 @@ SeqJIT::ModuleHandle SeqJIT::addModule(std::unique_ptr<Module> module) {
   return cantFail(optLayer.addModule(std::move(module), std::move(resolver)));
 }
 
-JITSymbol SeqJIT::findSymbol(std::string name) {
+std::string SeqJIT::mangle(const std::string &name) {
   std::string mangledName;
   raw_string_ostream mangledNameStream(mangledName);
   Mangler::getNameWithPrefix(mangledNameStream, name, layout);
-  return optLayer.findSymbol(mangledNameStream.str(), false);
+  return mangledNameStream.str();
+}
+
+JITSymbol SeqJIT::findSymbol(std::string name) {
+  return optLayer.findSymbol(mangle(name), false);
 }
 
 void SeqJIT::removeModule(SeqJIT::ModuleHandle handle) {
@@ -587,28 +1108,215 @@ Func *SeqJIT::makeFunc() {
   return func;
 }
 
+/*
+ * Drops the bodies of functions in the given module that were already compiled
+ * in a previous input. Functions that have become hot are moved to a separate
+ * module, returned in hotModule, to be compiled at the highest level. Returns
+ * the names of the functions that need (new) stubs, each paired with the name
+ * its definition was given in this module.
+ */
+std::vector<std::pair<std::string, std::string>>
+SeqJIT::reuseCompiled(Module *module, Function *entry,
+                      std::unique_ptr<Module> &hotModule) {
+  std::vector<Function *> funcs;
+  std::unordered_map<Function *, size_t> hashes;
+  std::unordered_map<Function *, std::vector<Function *>> callees;
+
+  for (Function &f : *module) {
+    // only functions that would otherwise be private to the module are
+    // tracked; anything else is externally visible by name already
+    if (&f == entry || f.isDeclaration() || !f.hasLocalLinkage())
+      continue;
+
+    std::vector<GlobalValue *> refs;
+    std::set<Value *> seen;
+    for (BasicBlock &block : f) {
+      for (Instruction &inst : block) {
+        for (Value *op : inst.operands())
+          collectRefs(op, refs, seen);
+      }
+    }
+
+    // referenced constants (e.g. string literals) are part of the function
+    // as far as we're concerned, so include them in its hash
+    std::string ir;
+    raw_string_ostream irStream(ir);
+    f.print(irStream);
+    for (GlobalValue *g : refs) {
+      if (auto *var = dyn_cast<GlobalVariable>(g)) {
+        if (var->hasLocalLinkage())
+          var->print(irStream);
+      } else if (auto *callee = dyn_cast<Function>(g)) {
+        if (!callee->isDeclaration())
+          callees[&f].push_back(callee);
+      }
+    }
+
+    funcs.push_back(&f);
+    hashes[&f] = std::hash<std::string>()(irStream.str());
+  }
+
+  // a function can only be reused if nothing it (transitively) calls has
+  // changed either, so fingerprint each function's entire call graph; names
+  // are included, so that two functions trading bodies changes both
+  auto fingerprint = [&](Function *f) {
+    size_t result = 0;
+    std::set<Function *> seen = {f};
+    std::vector<Function *> work = {f};
+    while (!work.empty()) {
+      Function *g = work.back();
+      work.pop_back();
+      hashCombine(result, std::hash<std::string>()(g->getName().str()));
+      auto it = hashes.find(g);
+      if (it != hashes.end())
+        hashCombine(result, it->second);
+      for (Function *callee : callees[g]) {
+        if (seen.insert(callee).second)
+          work.push_back(callee);
+      }
+    }
+    return result;
+  };
+
+  std::vector<Function *> reused, promoted, compiled;
+  for (Function *f : funcs) {
+    const std::string name = f->getName().str();
+    const size_t fp = fingerprint(f);
+    auto it = cache.find(name);
+
+    if (it != cache.end() && it->second.fingerprint == fp) {
+      CachedFunc &cached = it->second;
+      if (!cached.hot && __atomic_load_n(cached.calls, __ATOMIC_RELAXED) >=
+                             JIT_HOT_THRESHOLD) {
+        cached.hot = true;
+        promoted.push_back(f);
+      } else {
+        reused.push_back(f);
+      }
+    } else {
+      callCounts.push_back(0);
+      cache[name] = {fp, &callCounts.back(), false};
+      countCalls(f, &callCounts.back());
+      compiled.push_back(f);
+    }
+  }
+  stats.compiled += compiled.size();
+  stats.reused += reused.size();
+  stats.promoted += promoted.size();
+
+  // hot functions are recompiled together with private copies of whatever
+  // they call, so that the latter can be inlined
+  std::set<Function *> keep;
+  std::vector<Function *> work(promoted.begin(), promoted.end());
+  while (!work.empty()) {
+    Function *f = work.back();
+    work.pop_back();
+    for (Function *callee : callees[f]) {
+      if (keep.insert(callee).second)
+        work.push_back(callee);
+    }
+  }
+
+  std::vector<std::pair<std::string, std::string>> exported;
+  for (auto *list : {&compiled, &promoted}) {
+    for (Function *f : *list) {
+      const std::string name = f->getName().str();
+      f->setName(name + ".jit." + std::to_string(inputNum));
+      f->setLinkage(GlobalValue::ExternalLinkage);
+      exported.emplace_back(name, f->getName().str());
+    }
+  }
+
+  if (!promoted.empty()) {
+    // both modules have to refer to the same mutable data
+    for (GlobalVariable &g : module->globals()) {
+      if (g.hasLocalLinkage() && !g.isConstant()) {
+        g.setName(g.getName() + ".jit." + std::to_string(inputNum));
+        g.setLinkage(GlobalValue::ExternalLinkage);
+      }
+    }
+
+    std::set<std::string> hotNames, keepNames;
+    for (Function *f : promoted)
+      hotNames.insert(f->getName().str());
+    for (Function *f : keep)
+      keepNames.insert(f->getName().str());
+
+    // the hot module defines the hot functions and private copies of their
+    // callees; everything else is declared, and resolved by name
+    hotModule = CloneModule(module);
+    std::vector<GlobalVariable *> special;
+    for (GlobalVariable &g : hotModule->globals()) {
+      if (g.getName().startswith("llvm.")) {
+        special.push_back(&g);
+      } else if (!g.hasLocalLinkage() && g.hasInitializer()) {
+        g.setInitializer(nullptr);
+        g.setDSOLocal(false);
+      }
+    }
+    for (GlobalVariable *g : special)
+      g->eraseFromParent();
+
+    for (Function &f : *hotModule) {
+      if (f.isDeclaration() || hotNames.count(f.getName().str()))
+        continue;
+      if (keepNames.count(f.getName().str())) {
+        f.setLinkage(GlobalValue::InternalLinkage);
+      } else {
+        f.deleteBody();
+        f.setDSOLocal(false);
+      }
+    }
+  }
+
+  for (auto *list : {&reused, &promoted}) {
+    for (Function *f : *list) {
+      f->deleteBody();
+      f->setDSOLocal(false);
+    }
+  }
+  return exported;
+}
+
 void SeqJIT::exec(Func *func, std::unique_ptr<Module> module) {
   LLVMContext &context = config::config().context;
-  for (auto *var : globals)
-    var->reset();
+  for (auto &global : globals)
+    global.first->reset();
   Function *f = func->getFunc(module.get());
   f->setLinkage(GlobalValue::ExternalLinkage);
 
   // expose globals to the new function:
   IRBuilder<> builder(context);
   builder.SetInsertPoint(&*(*f->getBasicBlockList().begin()).begin());
-  for (auto *var : globals) {
+  for (auto &global : globals) {
+    Var *var = global.first;
     Value *ptr = var->getPtr(func);
-    auto sym = findSymbol(var->getName());
-    auto addr = (uint64_t)cantFail(sym.getAddress());
-    Value *addrVal = ConstantInt::get(seqIntLLVM(context), addr);
+    Value *addrVal = ConstantInt::get(seqIntLLVM(context), global.second);
     Value *ptrVal = builder.CreateIntToPtr(
         addrVal, var->getType()->getLLVMType(context)->getPointerTo());
     builder.CreateStore(ptrVal, ptr);
   }
 
   verifyModuleFailFast(*module);
+  std::unique_ptr<Module> hot;
+  auto exported = reuseCompiled(module.get(), f, hot);
+  // modules are optimized as they are added
+  if (hot) {
+    optLevel = JIT_HOT_OPT_LEVEL;
+    addModule(std::move(hot));
+  }
+  optLevel = JIT_BASE_OPT_LEVEL;
   addModule(std::move(module));
+
+  for (auto &e : exported) {
+    const std::string name = mangle(e.first);
+    auto addr = cantFail(findSymbol(e.second).getAddress());
+    if (stubs->findStub(name, false))
+      cantFail(stubs->updatePointer(name, addr));
+    else
+      cantFail(stubs->createStub(name, addr, JITSymbolFlags::Exported));
+  }
+
   auto sym = findSymbol(func->genericName());
   void (*fn)() = (void (*)())cantFail(sym.getAddress());
   fn();
@@ -652,14 +1360,17 @@ Var *SeqJIT::addVar(Expr *expr) {
   func->getBlock()->add(v);
 
   exec(func, std::move(module));
+  auto addr = (uint64_t)cantFail(findSymbol(var->getName()).getAddress());
   var->setREPL();
-  globals.push_back(var);
+  globals.emplace_back(var, addr);
   ++inputNum;
   return var;
 }
 
 void SeqJIT::delVar(Var *var) {
-  auto it = std::find(globals.begin(), globals.end(), var);
+  auto it = std::find_if(
+      globals.begin(), globals.end(),
+      [var](const std::pair<Var *, uint64_t> &g) { return g.first == var; });
   if (it != globals.end())
     globals.erase(it);
 }
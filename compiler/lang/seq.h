@@ -2,9 +2,11 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "lang/expr.h"
@@ -43,6 +45,9 @@ struct Config {
   llvm::LLVMContext context;
   bool debug;
   bool profile;
+  unsigned codegenThreads;
+  bool tiered;
+  bool pipelineStats;
 
   Config();
 };
@@ -75,7 +80,8 @@ private:
   llvm::Function *initFunc;
   llvm::Function *strlenFunc;
   llvm::Function *makeCanonicalMainFunc(llvm::Function *realMain);
-  void runCodegenPipeline();
+  void runCodegenPipeline(bool finalOptimize = true, unsigned optLevel = 3,
+                          bool profileHooks = true);
 
 public:
   SeqModule();
@@ -106,16 +112,54 @@ private:
       std::shared_ptr<llvm::Module>)>;
 
   llvm::orc::IRTransformLayer<decltype(comLayer), OptimizeFunction> optLayer;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
 
-  std::vector<Var *> globals;
+public:
+  /// Totals over all inputs so far
+  struct Stats {
+    /// Functions compiled (or recompiled after changing)
+    unsigned compiled;
+
+    /// Functions whose earlier compiled code was reused
+    unsigned reused;
+
+    /// Functions recompiled at the highest optimization level
+    unsigned promoted;
+  };
+
+private:
+  /// Bookkeeping for functions compiled in a previous input
+  struct CachedFunc {
+    /// Hash of the function's unoptimized IR, together with
+    /// that of everything it references
+    size_t fingerprint;
+
+    /// Number of times the compiled function was called so far
+    uint64_t *calls;
+
+    /// Whether this function was recompiled at the highest
+    /// optimization level
+    bool hot;
+  };
+
+  std::unordered_map<std::string, CachedFunc> cache;
+  /// Call counters of cached functions, updated by the JIT'd code
+  std::deque<uint64_t> callCounts;
+  std::vector<std::pair<Var *, uint64_t>> globals;
+  Stats stats;
+  unsigned optLevel;
   int inputNum;
 
   using ModuleHandle = decltype(optLayer)::ModuleHandleT;
   std::unique_ptr<llvm::Module> makeModule();
   ModuleHandle addModule(std::unique_ptr<llvm::Module> module);
+  std::string mangle(const std::string &name);
   llvm::JITSymbol findSymbol(std::string name);
   void removeModule(ModuleHandle key);
   Func *makeFunc();
+  std::vector<std::pair<std::string, std::string>>
+  reuseCompiled(llvm::Module *module, llvm::Function *entry,
+                std::unique_ptr<llvm::Module> &hotModule);
   void exec(Func *func, std::unique_ptr<llvm::Module> module);
 
 public:
@@ -125,6 +169,7 @@ public:
   void addExpr(Expr *expr, bool print = true);
   Var *addVar(Expr *expr);
   void delVar(Var *var);
+  const Stats &getStats() const { return stats; }
 };
 #endif
 
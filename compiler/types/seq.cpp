@@ -518,6 +518,146 @@ static Function *getStrFunc(types::KMer *kmerType, Module *module) {
   return func;
 }
 
+/*
+ * K-mer hashing uses murmur3's 64-bit finalizer, which is a bijection on
+ * 64-bit integers: for k <= 32, k-mers can be recovered from their hashes.
+ */
+static Value *codegenMix64(Value *x, IRBuilder<> &b) {
+  x = b.CreateXor(x, b.CreateLShr(x, 33));
+  x = b.CreateMul(x, b.getInt64(0xff51afd7ed558ccdULL));
+  x = b.CreateXor(x, b.CreateLShr(x, 33));
+  x = b.CreateMul(x, b.getInt64(0xc4ceb9fe1a85ec53ULL));
+  return b.CreateXor(x, b.CreateLShr(x, 33));
+}
+
+static Value *codegenUnmix64(Value *x, IRBuilder<> &b) {
+  x = b.CreateXor(x, b.CreateLShr(x, 33));
+  x = b.CreateMul(x, b.getInt64(0x9cb4b2f8129337dbULL));
+  x = b.CreateXor(x, b.CreateLShr(x, 33));
+  x = b.CreateMul(x, b.getInt64(0x4f74430c22a54005ULL));
+  return b.CreateXor(x, b.CreateLShr(x, 33));
+}
+
+static Value *codegenHash(types::KMer *kmerType, Value *self,
+                          IRBuilder<> &b) {
+  const unsigned bits = 2 * kmerType->getK();
+  if (bits <= 64)
+    return codegenMix64(b.CreateZExt(self, b.getInt64Ty()), b);
+
+  // fold in one 64-bit word at a time so that every base affects the hash
+  Value *hash = b.getInt64(0);
+  for (unsigned i = 0; i < bits; i += 64) {
+    Value *word = b.CreateTrunc(b.CreateLShr(self, i), b.getInt64Ty());
+    hash = codegenMix64(b.CreateXor(hash, word), b);
+  }
+  return hash;
+}
+
+/*
+ * Number of mismatched bases between two encoded k-mers of the same width:
+ * a base differs iff either of its two bits differs.
+ */
+static Value *codegenMismatches(Value *x, Value *y, IRBuilder<> &b) {
+  auto *ty = cast<IntegerType>(x->getType());
+  Value *lowBits =
+      ConstantInt::get(ty, APInt::getSplat(ty->getBitWidth(), APInt(2, 1)));
+  Value *diff = b.CreateXor(x, y);
+  diff = b.CreateAnd(b.CreateOr(diff, b.CreateLShr(diff, 1)), lowBits);
+  Function *popcnt = Intrinsic::getDeclaration(b.GetInsertBlock()->getModule(),
+                                               Intrinsic::ctpop, {ty});
+  return b.CreateZExtOrTrunc(b.CreateCall(popcnt, diff),
+                             seqIntLLVM(b.getContext()));
+}
+
+/*
+ * Hamming distances from a k-mer to each k-mer of an array. If `filter` is
+ * set, the function takes an extra maximum distance argument and instead
+ * returns the indices of the k-mers within that distance.
+ */
+static Function *getHammingManyFunc(types::KMer *kmerType, Module *module,
+                                    bool filter) {
+  const std::string name = "seq." + kmerType->getName() + ".hamming_" +
+                           (filter ? "filter" : "many");
+  LLVMContext &context = module->getContext();
+  Function *func = module->getFunction(name);
+
+  if (!func) {
+    types::ArrayType *arrType = types::ArrayType::get(kmerType);
+    types::ArrayType *outType = types::ArrayType::get(types::Int);
+    Type *retType = outType->getLLVMType(context);
+    Type *kmerLLVM = kmerType->getLLVMType(context);
+    Type *arrLLVM = arrType->getLLVMType(context);
+    func = cast<Function>(
+        filter ? module->getOrInsertFunction(name, retType, kmerLLVM, arrLLVM,
+                                             seqIntLLVM(context))
+               : module->getOrInsertFunction(name, retType, kmerLLVM, arrLLVM));
+    func->setDoesNotThrow();
+    func->setLinkage(GlobalValue::PrivateLinkage);
+
+    auto iter = func->arg_begin();
+    Value *kmer = iter++;
+    Value *arr = iter++;
+    Value *maxDist = filter ? iter : nullptr;
+
+    /*
+     * The loop body is branch-free so that the loop vectorizer can turn it
+     * into a SIMD loop; the backend then lowers the vector popcount to
+     * `vpopcntq` where available and to a nibble lookup table otherwise.
+     * K-mers that fit in 64 bits are widened so that every k uses 64-bit
+     * lanes regardless of its storage size.
+     */
+    BasicBlock *entry = BasicBlock::Create(context, "entry", func);
+    Value *ptr = arrType->memb(arr, "ptr", entry);
+    Value *len = arrType->memb(arr, "len", entry);
+    Value *out = types::Int->alloc(len, entry);
+    IRBuilder<> builder(entry);
+    Type *wideType = kmerType->getK() <= 32 ? builder.getInt64Ty()
+                                            : kmerType->getLLVMType(context);
+    Value *query = builder.CreateZExt(kmer, wideType);
+
+    BasicBlock *loop = BasicBlock::Create(context, "while", func);
+    builder.CreateBr(loop);
+    builder.SetInsertPoint(loop);
+
+    PHINode *control = builder.CreatePHI(seqIntLLVM(context), 2);
+    PHINode *count = builder.CreatePHI(seqIntLLVM(context), 2);
+    control->addIncoming(zeroLLVM(context), entry);
+    count->addIncoming(zeroLLVM(context), entry);
+    Value *cond = builder.CreateICmpSLT(control, len);
+
+    BasicBlock *body = BasicBlock::Create(context, "body", func);
+    BranchInst *branch =
+        builder.CreateCondBr(cond, body, body); // we set false-branch below
+
+    builder.SetInsertPoint(body);
+    Value *elem = builder.CreateLoad(builder.CreateGEP(ptr, control));
+    elem = builder.CreateZExt(elem, wideType);
+    Value *dist = codegenMismatches(query, elem, builder);
+    Value *countNext = count;
+
+    if (filter) {
+      builder.CreateStore(control, builder.CreateGEP(out, count));
+      Value *hit = builder.CreateICmpSLE(dist, maxDist);
+      hit = builder.CreateZExt(hit, seqIntLLVM(context));
+      countNext = builder.CreateAdd(count, hit);
+    } else {
+      builder.CreateStore(dist, builder.CreateGEP(out, control));
+    }
+
+    Value *next = builder.CreateAdd(control, oneLLVM(context));
+    control->addIncoming(next, body);
+    count->addIncoming(countNext, body);
+    builder.CreateBr(loop);
+
+    BasicBlock *exit = BasicBlock::Create(context, "exit", func);
+    branch->setSuccessor(1, exit);
+    builder.SetInsertPoint(exit);
+    builder.CreateRet(outType->make(out, filter ? count : len, exit));
+  }
+
+  return func;
+}
+
 static Value *codegenRevCompByBitShift(types::KMer *kmerType, Value *self,
                                        IRBuilder<> &b) {
   const unsigned k = kmerType->getK();
@@ -866,18 +1006,33 @@ void types::KMer::initOps() {
        },
        false},
 
+      // batch Hamming distance
+      {"hamming_many",
+       {ArrayType::get(this)},
+       ArrayType::get(Int),
+       [this](Value *self, std::vector<Value *> args, IRBuilder<> &b) {
+         Module *module = b.GetInsertBlock()->getModule();
+         return b.CreateCall(getHammingManyFunc(this, module, false),
+                             {self, args[0]});
+       },
+       false},
+
+      // indices of k-mers within a given Hamming distance
+      {"hamming_filter",
+       {ArrayType::get(this), Int},
+       ArrayType::get(Int),
+       [this](Value *self, std::vector<Value *> args, IRBuilder<> &b) {
+         Module *module = b.GetInsertBlock()->getModule();
+         return b.CreateCall(getHammingManyFunc(this, module, true),
+                             {self, args[0], args[1]});
+       },
+       false},
+
       {"__hash__",
        {},
        Int,
        [this](Value *self, std::vector<Value *> args, IRBuilder<> &b) {
-         Value *hash = b.CreateZExtOrTrunc(self, seqIntLLVM(b.getContext()));
-         if (getK() > 32) {
-           // make sure bases on both ends are involved in hash:
-           Value *aux = b.CreateLShr(self, 2 * getK() - 64);
-           aux = b.CreateZExtOrTrunc(aux, seqIntLLVM(b.getContext()));
-           hash = b.CreateXor(hash, aux);
-         }
-         return hash;
+         return codegenHash(this, self, b);
        },
        false},
 
@@ -1041,6 +1196,35 @@ void types::KMer::initOps() {
             return func;
           }),
       true);
+
+  // inverse of __hash__, only possible when the k-mer fits in the hash
+  if (k <= 32) {
+    addMethod(
+        "unhash",
+        new BaseFuncLite(
+            {types::Int}, this,
+            [this](Module *module) {
+              const std::string name = "seq." + getName() + ".unhash";
+              Function *func = module->getFunction(name);
+
+              if (!func) {
+                LLVMContext &context = module->getContext();
+                func = cast<Function>(module->getOrInsertFunction(
+                    name, getLLVMType(context), seqIntLLVM(context)));
+                func->setDoesNotThrow();
+                func->setLinkage(GlobalValue::PrivateLinkage);
+                func->addFnAttr(Attribute::AlwaysInline);
+                Value *arg = func->arg_begin();
+                BasicBlock *block = BasicBlock::Create(context, "entry", func);
+                IRBuilder<> builder(block);
+                builder.CreateRet(builder.CreateTrunc(
+                    codegenUnmix64(arg, builder), getLLVMType(context)));
+              }
+
+              return func;
+            }),
+        true);
+  }
 }
 
 bool types::KMer::isAtomic() const { return true; }
@@ -0,0 +1,731 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "lib.h"
+#include "wakeup.h"
+
+/*
+ * Multithreaded gzip reader and BGZF writer
+ *
+ * BGZF files (a series of independent gzip members, each of which records
+ * its own compressed size) are split into members by a producer thread and
+ * inflated in parallel by a pool of workers; members are handed back to the
+ * reader in file order. Anything else -- single-stream gzip, or plain data,
+ * which is passed through -- is decompressed by the producer thread alone,
+ * which still runs ahead of the reader.
+ *
+ * The input is a single file descriptor that is read exactly once: the
+ * bytes inspected to tell the formats apart stay buffered for the
+ * producer, so pipes and FIFOs work. Only seeking backwards needs to
+ * rewind the descriptor. A producer waiting for input is woken up when the
+ * reader shuts down, so closing never blocks on an idle pipe.
+ *
+ * The writer works the other way around: full blocks are deflated by a pool
+ * of workers and written out in order by a dedicated thread.
+ */
+
+namespace {
+const size_t GZ_STREAM_CHUNK = 1 << 20;
+const size_t BGZF_HEADER = 18; // fixed header up to and including BSIZE
+const size_t BGZF_BLOCK = 0xff00; // uncompressed bytes per written block
+const size_t BGZF_MAX = 0x10000;  // largest possible BGZF member
+
+struct GzBlock {
+  std::vector<char> data; // compressed member, then its inflated contents
+  std::string error;
+  bool ready;
+};
+
+inline uint32_t le16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+
+inline uint32_t le32(const unsigned char *p) {
+  return le16(p) | ((uint32_t)le16(p + 2) << 16);
+}
+
+inline void put16(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+inline void put32(unsigned char *p, uint32_t v) {
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+// total size of the BGZF member starting with header h, or 0 if h is not a
+// BGZF header
+size_t bgzfBlockSize(const unsigned char *h, size_t n) {
+  if (n < BGZF_HEADER || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 ||
+      !(h[3] & 4))
+    return 0;
+  if (le16(h + 10) < 6 || h[12] != 'B' || h[13] != 'C' || le16(h + 14) != 2)
+    return 0;
+  return le16(h + 16) + 1;
+}
+
+bool inflateBlock(std::vector<char> &block, std::string &error) {
+  const auto *b = (const unsigned char *)block.data();
+  const size_t n = block.size();
+  const size_t start = 12 + le16(b + 10);
+  if (n < start + 8) {
+    error = "truncated BGZF block";
+    return false;
+  }
+  const uint32_t crc = le32(b + n - 8);
+  const uint32_t size = le32(b + n - 4);
+  std::vector<char> out(size);
+
+  if (size > 0) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) {
+      error = "could not initialize zlib";
+      return false;
+    }
+    zs.next_in = (Bytef *)(b + start);
+    zs.avail_in = (uInt)(n - start - 8);
+    zs.next_out = (Bytef *)out.data();
+    zs.avail_out = size;
+    const int status = inflate(&zs, Z_FINISH);
+    const uLong total = zs.total_out;
+    inflateEnd(&zs);
+    if (status != Z_STREAM_END || total != size) {
+      error = "invalid BGZF block";
+      return false;
+    }
+  }
+
+  if (crc32(0L, (const Bytef *)out.data(), size) != crc) {
+    error = "BGZF block CRC mismatch";
+    return false;
+  }
+  block.swap(out);
+  return true;
+}
+
+// replaces `block` with a BGZF member holding its contents
+bool deflateBlock(std::vector<char> &block, int level, std::string &error) {
+  const uint32_t size = (uint32_t)block.size();
+  std::vector<char> out(BGZF_HEADER + compressBound(size) + 8);
+  auto *b = (unsigned char *)out.data();
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) !=
+      Z_OK) {
+    error = "could not initialize zlib";
+    return false;
+  }
+  zs.next_in = (Bytef *)block.data();
+  zs.avail_in = size;
+  zs.next_out = b + BGZF_HEADER;
+  zs.avail_out = (uInt)(out.size() - BGZF_HEADER - 8);
+  const int status = deflate(&zs, Z_FINISH);
+  const size_t total = BGZF_HEADER + zs.total_out + 8;
+  deflateEnd(&zs);
+  if (status != Z_STREAM_END || total > BGZF_MAX) {
+    error = "could not compress BGZF block";
+    return false;
+  }
+
+  static const unsigned char header[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0,
+                                         0xff, 6,    0, 'B', 'C', 2, 0};
+  memcpy(b, header, sizeof(header));
+  put16(b + 16, (uint32_t)(total - 1));
+  put32(b + total - 8, crc32(0L, (const Bytef *)block.data(), size));
+  put32(b + total - 4, size);
+  out.resize(total);
+  block.swap(out);
+  return true;
+}
+
+// buffered reads from a file descriptor
+struct FdInput {
+  int fd;
+  off_t origin; // offset of the start of the input, if seekable
+  std::vector<char> buf;
+  size_t pos, end;
+  bool failed;
+  Wakeup wakeup; // interrupts a fill() that is waiting for input
+
+  explicit FdInput(int fd)
+      : fd(fd), origin(lseek(fd, 0, SEEK_CUR)), buf(GZ_STREAM_CHUNK), pos(0),
+        end(0), failed(false), wakeup() {}
+
+  ~FdInput() { close(fd); }
+
+  // reads more input after the unread bytes; returns false at end of input,
+  // on error or when interrupted
+  bool fill() {
+    if (pos > 0) {
+      memmove(buf.data(), buf.data() + pos, end - pos);
+      end -= pos;
+      pos = 0;
+    }
+    if (end == buf.size())
+      return true;
+    ssize_t n;
+    do {
+      if (!wakeup.wait(fd))
+        return false;
+      n = ::read(fd, buf.data() + end, buf.size() - end);
+    } while (n < 0 && (errno == EINTR || errno == EAGAIN));
+    if (n < 0) {
+      failed = true;
+      return false;
+    }
+    end += n;
+    return n > 0;
+  }
+
+  // buffers at least `n` bytes if the input has them; returns the number
+  // of bytes buffered
+  size_t peek(size_t n) {
+    while (end - pos < n && fill())
+      ;
+    return end - pos;
+  }
+
+  bool gzipMagic() {
+    return peek(2) >= 2 && (unsigned char)buf[pos] == 0x1f &&
+           (unsigned char)buf[pos + 1] == 0x8b;
+  }
+
+  size_t read(char *dst, size_t n) {
+    size_t total = 0;
+    while (total < n) {
+      if (pos == end && !fill())
+        break;
+      const size_t k = std::min(n - total, end - pos);
+      memcpy(dst + total, buf.data() + pos, k);
+      pos += k;
+      total += k;
+    }
+    return total;
+  }
+
+  bool seekable() const { return origin >= 0; }
+
+  bool rewind() {
+    if (lseek(fd, origin, SEEK_SET) < 0)
+      return false;
+    pos = end = 0;
+    failed = false;
+    return true;
+  }
+};
+
+class GzReader {
+  FdInput in;
+  unsigned threads;
+  size_t maxBlocks; // decompressed or in-flight blocks held at once
+
+  std::mutex lock;
+  std::condition_variable produced; // a block became ready, or input ended
+  std::condition_variable consumed; // a block was taken, or stopping
+  std::condition_variable pending;  // a block needs inflating, or stopping
+  std::map<uint64_t, GzBlock> blocks;
+  std::deque<uint64_t> jobs;
+  uint64_t nextIn, nextOut;
+  bool done, stop;
+  std::thread producer;
+  std::vector<std::thread> workers;
+
+  // reader side
+  std::vector<char> cur;
+  size_t curPos;
+  seq_int_t pos;
+
+  void finish() {
+    std::lock_guard<std::mutex> l(lock);
+    done = true;
+    produced.notify_all();
+    pending.notify_all();
+  }
+
+  // queues a block, waiting while too many are outstanding; returns false
+  // if the reader is shutting down
+  bool push(std::vector<char> &&data, bool ready, const std::string &error) {
+    std::unique_lock<std::mutex> l(lock);
+    consumed.wait(l, [this] { return stop || blocks.size() < maxBlocks; });
+    if (stop)
+      return false;
+    const uint64_t id = nextIn++;
+    GzBlock &block = blocks[id];
+    block.data = std::move(data);
+    block.error = error;
+    block.ready = ready;
+    if (ready)
+      produced.notify_all();
+    else {
+      jobs.push_back(id);
+      pending.notify_one();
+    }
+    return true;
+  }
+
+  void produceBGZF() {
+    unsigned char h[BGZF_HEADER];
+    while (true) {
+      const size_t n = in.read((char *)h, BGZF_HEADER);
+      if (n == 0) {
+        if (in.failed)
+          push({}, true, std::string("read error: ") + strerror(errno));
+        break;
+      }
+      const size_t size = bgzfBlockSize(h, n);
+      std::vector<char> data(std::max(size, BGZF_HEADER));
+      if (size < BGZF_HEADER ||
+          in.read(data.data() + BGZF_HEADER, size - BGZF_HEADER) !=
+              size - BGZF_HEADER) {
+        push({}, true, "truncated or invalid BGZF block");
+        break;
+      }
+      memcpy(data.data(), h, BGZF_HEADER);
+      if (!push(std::move(data), false, ""))
+        break;
+    }
+  }
+
+  // plain data is passed through as it arrives
+  void producePlain() {
+    while (true) {
+      if (in.pos == in.end && !in.fill()) {
+        if (in.failed)
+          push({}, true, std::string("read error: ") + strerror(errno));
+        break;
+      }
+      std::vector<char> data(in.buf.begin() + in.pos, in.buf.begin() + in.end);
+      in.pos = in.end;
+      if (!push(std::move(data), true, ""))
+        break;
+    }
+  }
+
+  // gzip members, possibly concatenated, are inflated one after another;
+  // like gzread, anything after the last member that is not gzip is
+  // ignored
+  void produceStream() {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+      push({}, true, "could not initialize zlib");
+      return;
+    }
+    std::vector<char> data(GZ_STREAM_CHUNK);
+    zs.next_out = (Bytef *)data.data();
+    zs.avail_out = (uInt)data.size();
+    std::string error;
+    bool member = true;
+    while (true) {
+      // what has been inflated is handed over before waiting for more input
+      if (zs.avail_out == 0 ||
+          (in.pos == in.end && zs.avail_out < data.size())) {
+        data.resize(data.size() - zs.avail_out);
+        if (!push(std::move(data), true, "")) {
+          inflateEnd(&zs);
+          return;
+        }
+        data.assign(GZ_STREAM_CHUNK, 0);
+        zs.next_out = (Bytef *)data.data();
+        zs.avail_out = (uInt)data.size();
+      }
+      if (!member) {
+        if (!in.gzipMagic())
+          break;
+        inflateReset(&zs);
+        member = true;
+      }
+      if (in.pos == in.end && !in.fill()) {
+        error = in.failed ? std::string("read error: ") + strerror(errno)
+                          : "zlib error: unexpected end of file";
+        break;
+      }
+      zs.next_in = (Bytef *)(in.buf.data() + in.pos);
+      zs.avail_in = (uInt)(in.end - in.pos);
+      const int status = inflate(&zs, Z_NO_FLUSH);
+      in.pos = in.end - zs.avail_in;
+      if (status == Z_STREAM_END) {
+        member = false;
+      } else if (status != Z_OK && status != Z_BUF_ERROR) {
+        error = std::string("zlib error: ") +
+                (zs.msg ? zs.msg : "invalid compressed data");
+        break;
+      }
+    }
+    inflateEnd(&zs);
+    data.resize(data.size() - zs.avail_out);
+    if (!data.empty() && !push(std::move(data), true, ""))
+      return;
+    if (!error.empty())
+      push({}, true, error);
+  }
+
+  void work() {
+    while (true) {
+      GzBlock *block;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        pending.wait(l, [this] { return stop || done || !jobs.empty(); });
+        if (stop || jobs.empty())
+          return;
+        block = &blocks[jobs.front()];
+        jobs.pop_front();
+      }
+      std::string error;
+      inflateBlock(block->data, error);
+      std::lock_guard<std::mutex> l(lock);
+      block->error = error;
+      block->ready = true;
+      produced.notify_all();
+    }
+  }
+
+  void start() {
+    nextIn = nextOut = 0;
+    done = stop = false;
+    cur.clear();
+    curPos = 0;
+    pos = 0;
+
+    // the sniffed bytes stay in the input buffer
+    const size_t n = in.peek(BGZF_HEADER);
+    if (bgzfBlockSize((const unsigned char *)in.buf.data() + in.pos, n)) {
+      producer = std::thread([this] {
+        produceBGZF();
+        finish();
+      });
+      for (unsigned i = 0; i < threads; i++)
+        workers.emplace_back(&GzReader::work, this);
+    } else if (in.gzipMagic()) {
+      producer = std::thread([this] {
+        produceStream();
+        finish();
+      });
+    } else {
+      producer = std::thread([this] {
+        producePlain();
+        finish();
+      });
+    }
+  }
+
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      stop = true;
+    }
+    produced.notify_all();
+    consumed.notify_all();
+    pending.notify_all();
+    in.wakeup.signal();
+    producer.join();
+    in.wakeup.reset();
+    for (auto &worker : workers)
+      worker.join();
+    workers.clear();
+    blocks.clear();
+    jobs.clear();
+  }
+
+  // whether next() can return without waiting; the lock must be held
+  bool nextReady() {
+    auto it = blocks.find(nextOut);
+    return (it != blocks.end() && it->second.ready) ||
+           (done && nextOut == nextIn);
+  }
+
+  // moves the next block into `cur`; returns 0 at end of input, -1 on error
+  int next() {
+    std::unique_lock<std::mutex> l(lock);
+    produced.wait(l, [this] { return nextReady(); });
+    auto it = blocks.find(nextOut);
+    if (it == blocks.end())
+      return 0;
+    if (!it->second.error.empty()) {
+      error = it->second.error;
+      return -1;
+    }
+    cur.swap(it->second.data);
+    curPos = 0;
+    blocks.erase(it);
+    ++nextOut;
+    consumed.notify_one();
+    return 1;
+  }
+
+public:
+  std::string error;
+
+  GzReader(int fd, seq_int_t threads)
+      : in(fd), threads(0), maxBlocks(0), blocks(), jobs(), nextIn(0),
+        nextOut(0), done(false), stop(false), producer(), workers(), cur(),
+        curPos(0), pos(0), error() {
+    if (threads <= 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    this->threads = (unsigned)threads;
+    maxBlocks = 4 * this->threads + 4;
+    start();
+  }
+
+  ~GzReader() { shutdown(); }
+
+  // waits for some data, then returns as much as is ready, up to `n` bytes;
+  // returns 0 at end of input and -1 on error
+  seq_int_t read(char *buf, seq_int_t n) {
+    seq_int_t total = 0;
+    while (total < n) {
+      if (curPos == cur.size()) {
+        if (total > 0) {
+          std::lock_guard<std::mutex> l(lock);
+          if (!nextReady())
+            break;
+        }
+        const int status = next();
+        if (status < 0)
+          return -1;
+        if (status == 0)
+          break;
+        continue;
+      }
+      const size_t m = std::min((size_t)(n - total), cur.size() - curPos);
+      if (buf)
+        memcpy(buf + total, cur.data() + curPos, m);
+      curPos += m;
+      total += m;
+    }
+    pos += total;
+    return total;
+  }
+
+  seq_int_t tell() const { return pos; }
+
+  // like gzseek, seeking backwards restarts decompression from the start,
+  // which is only possible if the input itself can be rewound
+  seq_int_t seek(seq_int_t offset) {
+    if (offset < pos) {
+      if (!in.seekable()) {
+        error = "cannot seek backwards in a non-seekable input";
+        return -1;
+      }
+      shutdown();
+      if (!in.rewind()) {
+        error = std::string("could not rewind input: ") + strerror(errno);
+        return -1;
+      }
+      start();
+    }
+    while (pos < offset) {
+      const seq_int_t n = read(nullptr, offset - pos);
+      if (n < 0)
+        return -1;
+      if (n == 0)
+        break;
+    }
+    return pos;
+  }
+};
+class BgzfWriter {
+  FILE *fp;
+  int level;
+  size_t maxBlocks;
+
+  std::mutex lock;
+  std::condition_variable compressed; // a block is ready, or closing
+  std::condition_variable written;    // a block was written out
+  std::condition_variable pending;    // a block needs deflating, or closing
+  std::map<uint64_t, GzBlock> blocks;
+  std::deque<uint64_t> jobs;
+  uint64_t nextIn, nextOut;
+  bool closing;
+  std::thread writer;
+  std::vector<std::thread> workers;
+  std::vector<char> cur; // block being filled by the caller
+
+  void fail(const std::string &msg) {
+    if (error.empty())
+      error = msg;
+  }
+
+  void work() {
+    while (true) {
+      GzBlock *block;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        pending.wait(l, [this] { return closing || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        block = &blocks[jobs.front()];
+        jobs.pop_front();
+      }
+      std::string err;
+      deflateBlock(block->data, level, err);
+      std::lock_guard<std::mutex> l(lock);
+      block->error = err;
+      block->ready = true;
+      compressed.notify_all();
+    }
+  }
+
+  void write() {
+    while (true) {
+      std::vector<char> data;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        compressed.wait(l, [this] {
+          auto it = blocks.find(nextOut);
+          return (it != blocks.end() && it->second.ready) ||
+                 (closing && nextOut == nextIn);
+        });
+        auto it = blocks.find(nextOut);
+        if (it == blocks.end())
+          return;
+        if (!it->second.error.empty())
+          fail(it->second.error);
+        data.swap(it->second.data);
+        blocks.erase(it);
+        ++nextOut;
+        written.notify_all();
+      }
+      // after an error, the remaining blocks are dropped
+      if (error.empty() && fwrite(data.data(), 1, data.size(), fp) !=
+                               data.size()) {
+        std::lock_guard<std::mutex> l(lock);
+        fail("error in write");
+      }
+    }
+  }
+
+  // hands the current block to the workers
+  void submit() {
+    std::unique_lock<std::mutex> l(lock);
+    written.wait(l, [this] { return blocks.size() < maxBlocks; });
+    const uint64_t id = nextIn++;
+    GzBlock &block = blocks[id];
+    block.data.swap(cur);
+    block.ready = false;
+    jobs.push_back(id);
+    pending.notify_one();
+    cur.clear();
+    cur.reserve(BGZF_BLOCK);
+  }
+
+public:
+  std::string error;
+
+  BgzfWriter(FILE *fp, seq_int_t threads, seq_int_t level)
+      : fp(fp), level((int)level), maxBlocks(0), blocks(), jobs(), nextIn(0),
+        nextOut(0), closing(false), writer(), workers(), cur(), error() {
+    if (threads <= 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    maxBlocks = 4 * threads + 4;
+    cur.reserve(BGZF_BLOCK);
+    writer = std::thread(&BgzfWriter::write, this);
+    for (seq_int_t i = 0; i < threads; i++)
+      workers.emplace_back(&BgzfWriter::work, this);
+  }
+
+  seq_int_t add(const char *buf, seq_int_t n) {
+    seq_int_t done = 0;
+    while (done < n) {
+      const size_t m = std::min((size_t)(n - done), BGZF_BLOCK - cur.size());
+      cur.insert(cur.end(), buf + done, buf + done + m);
+      done += m;
+      if (cur.size() == BGZF_BLOCK)
+        submit();
+    }
+    std::lock_guard<std::mutex> l(lock);
+    return error.empty() ? n : -1;
+  }
+
+  // flushes everything, ending with the empty block that marks BGZF EOF
+  bool close() {
+    if (!cur.empty())
+      submit();
+    submit();
+    {
+      std::lock_guard<std::mutex> l(lock);
+      closing = true;
+    }
+    pending.notify_all();
+    compressed.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+    writer.join();
+    if (fclose(fp) != 0)
+      fail("error in close");
+    return error.empty();
+  }
+};
+} // namespace
+
+SEQ_FUNC void *seq_gz_open(const char *path, seq_int_t threads) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  return new GzReader(fd, threads);
+}
+
+SEQ_FUNC void *seq_gz_fopen(void *fp, seq_int_t threads) {
+  const int fd = dup(fileno((FILE *)fp));
+  if (fd < 0)
+    return nullptr;
+  return new GzReader(fd, threads);
+}
+
+SEQ_FUNC seq_int_t seq_gz_read(void *gz, char *buf, seq_int_t n) {
+  return ((GzReader *)gz)->read(buf, n);
+}
+
+SEQ_FUNC seq_int_t seq_gz_tell(void *gz) { return ((GzReader *)gz)->tell(); }
+
+SEQ_FUNC seq_int_t seq_gz_seek(void *gz, seq_int_t offset) {
+  return ((GzReader *)gz)->seek(offset);
+}
+
+SEQ_FUNC const char *seq_gz_error(void *gz) {
+  return ((GzReader *)gz)->error.c_str();
+}
+
+SEQ_FUNC void seq_gz_close(void *gz) { delete (GzReader *)gz; }
+
+SEQ_FUNC void *seq_bgzf_open(const char *path, seq_int_t threads,
+                             seq_int_t level) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp)
+    return nullptr;
+  return new BgzfWriter(fp, threads, level);
+}
+
+SEQ_FUNC seq_int_t seq_bgzf_write(void *bgzf, const char *buf, seq_int_t n) {
+  return ((BgzfWriter *)bgzf)->add(buf, n);
+}
+
+SEQ_FUNC const char *seq_bgzf_error(void *bgzf) {
+  return ((BgzfWriter *)bgzf)->error.c_str();
+}
+
+SEQ_FUNC seq_str_t seq_bgzf_close(void *bgzf) {
+  auto *writer = (BgzfWriter *)bgzf;
+  seq_str_t msg = {0, nullptr};
+  if (!writer->close()) {
+    msg.len = (seq_int_t)writer->error.size();
+    msg.str = (char *)seq_alloc_atomic(writer->error.size());
+    memcpy(msg.str, writer->error.data(), writer->error.size());
+  }
+  delete writer;
+  return msg;
+}
@@ -13,6 +13,8 @@
 #include <map>
 #include <mutex>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <unwind.h>
@@ -222,6 +224,32 @@ SEQ_FUNC void *seq_stdout() { return stdout; }
 
 SEQ_FUNC void *seq_stderr() { return stderr; }
 
+// Maps the regular file behind `fp` read-only, or returns null (e.g. for a
+// pipe) so the caller can fall back to stdio.
+SEQ_FUNC void *seq_mmap_file(void *fp, seq_int_t *len) {
+  static char empty = 0;
+  const int fd = fileno((FILE *)fp);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return nullptr;
+  *len = (seq_int_t)st.st_size;
+  if (st.st_size == 0)
+    return &empty;
+  void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return nullptr;
+  madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(p, (size_t)st.st_size, MADV_HUGEPAGE);
+#endif
+  return p;
+}
+
+SEQ_FUNC void seq_munmap(void *p, seq_int_t len) {
+  if (len > 0)
+    munmap(p, (size_t)len);
+}
+
 /*
  * dlopen
  */
@@ -52,5 +52,69 @@ SEQ_FUNC seq_str_t seq_str_ptr(void *p);
 SEQ_FUNC seq_str_t seq_str_tuple(seq_str_t *strs, seq_int_t n);
 
 SEQ_FUNC void seq_print(seq_str_t str);
+SEQ_FUNC void *seq_mmap_file(void *fp, seq_int_t *len);
+SEQ_FUNC void seq_munmap(void *p, seq_int_t len);
+
+SEQ_FUNC void seq_prof_enter(const char *name);
+SEQ_FUNC void seq_prof_exit(const char *name);
+
+SEQ_FUNC void *seq_pipe_stats(const char *id, const char **names,
+                              seq_int_t n);
+SEQ_FUNC void seq_pipe_start(void *stats);
+SEQ_FUNC void seq_pipe_stop(void *stats);
+SEQ_FUNC void seq_pipe_stage(void *stats, seq_int_t stage);
+SEQ_FUNC void seq_pipe_resume(void *stats, seq_int_t stage);
+SEQ_FUNC void seq_pipe_yield(void *stats, seq_int_t stage);
+SEQ_FUNC void seq_pipe_batch(void *stats, seq_int_t stage, seq_int_t filled,
+                             seq_int_t capacity);
+
+SEQ_FUNC void seq_nt4_encode(const char *s, seq_int_t n, uint8_t *out);
+SEQ_FUNC void seq_base_counts(const char *s, seq_int_t n, seq_int_t *counts);
+SEQ_FUNC seq_int_t seq_find_ambiguous(const char *s, seq_int_t n);
+SEQ_FUNC void seq_position_counts(seq_t s, seq_int_t *counts, seq_int_t len);
+SEQ_FUNC void seq_revcomp(const char *s, seq_int_t n, char *out);
+SEQ_FUNC seq_int_t seq_validate_nt(const char *s, seq_int_t n, char *out,
+                                   bool upper);
+SEQ_FUNC seq_int_t seq_validate_qual(const char *s, seq_int_t n, char *out);
+SEQ_FUNC seq_int_t seq_strip_newlines(const char *s, seq_int_t n, char *out);
+SEQ_FUNC seq_int_t seq_simd_limit(seq_int_t level);
+SEQ_FUNC seq_int_t seq_kmers_block(seq_t s, seq_int_t k, seq_int_t step,
+                                   bool canonical, seq_int_t *next,
+                                   uint64_t *kmers, seq_int_t *pos,
+                                   seq_int_t cap);
+SEQ_FUNC seq_int_t seq_minimizers_block(seq_t s, seq_int_t k, seq_int_t w,
+                                        uint64_t seed, bool canonical,
+                                        seq_int_t *next, seq_int_t *last,
+                                        uint64_t *kmers, seq_int_t *pos,
+                                        seq_int_t cap);
+SEQ_FUNC seq_int_t seq_syncmers_block(seq_t s, seq_int_t k, seq_int_t sl,
+                                      seq_int_t t, uint64_t seed,
+                                      bool canonical, seq_int_t *next,
+                                      uint64_t *kmers, seq_int_t *pos,
+                                      seq_int_t cap);
+SEQ_FUNC seq_int_t seq_nthash_block(seq_t s, seq_int_t k, bool canonical,
+                                    uint64_t *state, uint64_t *hashes,
+                                    seq_int_t *pos, seq_int_t cap);
+
+SEQ_FUNC void *seq_gz_open(const char *path, seq_int_t threads);
+SEQ_FUNC void *seq_gz_fopen(void *fp, seq_int_t threads);
+SEQ_FUNC seq_int_t seq_gz_read(void *gz, char *buf, seq_int_t n);
+SEQ_FUNC seq_int_t seq_gz_tell(void *gz);
+SEQ_FUNC seq_int_t seq_gz_seek(void *gz, seq_int_t offset);
+SEQ_FUNC const char *seq_gz_error(void *gz);
+SEQ_FUNC void seq_gz_close(void *gz);
+SEQ_FUNC void *seq_bgzf_open(const char *path, seq_int_t threads,
+                             seq_int_t level);
+SEQ_FUNC seq_int_t seq_bgzf_write(void *bgzf, const char *buf, seq_int_t n);
+SEQ_FUNC const char *seq_bgzf_error(void *bgzf);
+SEQ_FUNC seq_str_t seq_bgzf_close(void *bgzf);
+
+SEQ_FUNC void *seq_readahead_open(void *fp, seq_int_t buffers,
+                                  seq_int_t size);
+SEQ_FUNC seq_int_t seq_readahead_read(void *ra, char *buf, seq_int_t n);
+SEQ_FUNC seq_int_t seq_readahead_tell(void *ra);
+SEQ_FUNC seq_int_t seq_readahead_seek(void *ra, seq_int_t offset,
+                                      seq_int_t whence);
+SEQ_FUNC void seq_readahead_close(void *ra);
 
 #endif /* SEQ_LIB_H */
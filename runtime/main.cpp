@@ -23,8 +23,16 @@ static void versMsg(raw_ostream &out) {
 int main(int argc, char **argv) {
   opt<string> input(Positional, desc("<input file>"), init("-"));
   opt<bool> debug("d", desc("Compile in debug mode"));
-  opt<bool> profile("prof", desc("Profile LLVM IR using XRay"));
+  opt<bool> profile("prof", desc("Profile function execution times"));
+  opt<bool> pipeStats(
+      "pipestats", desc("Collect and report per-stage pipeline statistics"));
   opt<bool> docstr("docstr", desc("Generate docstrings"));
+  opt<unsigned> threads(
+      "j", desc("Number of threads to use for code generation"), init(1));
+  opt<bool> tiered(
+      "tiered",
+      desc("Start running quickly compiled code, and optimize hot functions "
+           "in the background"));
   opt<string> output(
       "o",
       desc("Write LLVM bitcode to specified file instead of running with JIT"));
@@ -38,6 +46,9 @@ int main(int argc, char **argv) {
 
   config::config().debug = debug.getValue();
   config::config().profile = profile.getValue();
+  config::config().codegenThreads = threads.getValue();
+  config::config().tiered = tiered.getValue();
+  config::config().pipelineStats = pipeStats.getValue();
 
   if (docstr.getValue()) {
     generateDocstr(argv[0]);
@@ -0,0 +1,840 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "lib.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/*
+ * Nucleotide kernels
+ *
+ * SSE2 is part of the x86-64 baseline; the SSSE3 and AVX2 kernels are
+ * compiled for their own targets and picked at run time from what the
+ * CPU supports, so they are used without building the runtime for a
+ * specific machine.
+ */
+
+namespace {
+enum SIMDLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_SSSE3, SIMD_AVX2 };
+
+int detectSIMD() {
+#ifdef __SSE2__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return SIMD_SSSE3;
+  return SIMD_SSE2;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+const int simdSupported = detectSIMD();
+std::atomic<int> simdLevel(simdSupported); // lowered by seq_simd_limit
+
+inline int simd() { return simdLevel.load(std::memory_order_relaxed); }
+
+// bases encoded per call to the k-mer kernel's inner loop
+const seq_int_t NT_BLOCK = 256;
+
+struct NT4Table {
+  uint8_t t[256];
+  NT4Table() {
+    std::fill(t, t + 256, 4);
+    t['A'] = t['a'] = 0;
+    t['C'] = t['c'] = 1;
+    t['G'] = t['g'] = 2;
+    t['T'] = t['t'] = 3;
+  }
+};
+
+const NT4Table nt4;
+
+#ifdef __SSE2__
+__attribute__((target("avx2"))) inline void encode32(const char *s,
+                                                     uint8_t *out) {
+  __m256i x = _mm256_loadu_si256((const __m256i *)s);
+  x = _mm256_and_si256(x, _mm256_set1_epi8((char)0xDF)); // upper-case
+  __m256i a = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('A'));
+  __m256i c = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('C'));
+  __m256i g = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('G'));
+  __m256i t = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('T'));
+  __m256i code = _mm256_or_si256(
+      _mm256_or_si256(_mm256_and_si256(c, _mm256_set1_epi8(1)),
+                      _mm256_and_si256(g, _mm256_set1_epi8(2))),
+      _mm256_and_si256(t, _mm256_set1_epi8(3)));
+  __m256i valid = _mm256_or_si256(_mm256_or_si256(a, c), _mm256_or_si256(g, t));
+  code = _mm256_or_si256(code, _mm256_andnot_si256(valid, _mm256_set1_epi8(4)));
+  _mm256_storeu_si256((__m256i *)out, code);
+}
+
+__attribute__((target("avx2"))) seq_int_t encodeAVX2(const char *s,
+                                                     seq_int_t n,
+                                                     uint8_t *out) {
+  seq_int_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    encode32(s + i, out + i);
+  return i;
+}
+#endif
+
+#ifdef __SSE2__
+inline void encode16(const char *s, uint8_t *out) {
+  __m128i x = _mm_loadu_si128((const __m128i *)s);
+  x = _mm_and_si128(x, _mm_set1_epi8((char)0xDF)); // upper-case
+  __m128i a = _mm_cmpeq_epi8(x, _mm_set1_epi8('A'));
+  __m128i c = _mm_cmpeq_epi8(x, _mm_set1_epi8('C'));
+  __m128i g = _mm_cmpeq_epi8(x, _mm_set1_epi8('G'));
+  __m128i t = _mm_cmpeq_epi8(x, _mm_set1_epi8('T'));
+  __m128i code =
+      _mm_or_si128(_mm_or_si128(_mm_and_si128(c, _mm_set1_epi8(1)),
+                                _mm_and_si128(g, _mm_set1_epi8(2))),
+                   _mm_and_si128(t, _mm_set1_epi8(3)));
+  __m128i valid = _mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(g, t));
+  code = _mm_or_si128(code, _mm_andnot_si128(valid, _mm_set1_epi8(4)));
+  _mm_storeu_si128((__m128i *)out, code);
+}
+#endif
+
+// IUPAC complements; anything else complements to 'N' (as byte.comp())
+struct CompTable {
+  char t[256];
+  CompTable() {
+    const char *from = "ACBDGHKMNSRUTWVYacbdghkmnsrutwvy.-";
+    const char *to = "TGVHCDMKNSYAAWBRtgvhcdmknsyaawbr.-";
+    std::fill(t, t + 256, 'N');
+    for (unsigned i = 0; from[i]; i++)
+      t[(uint8_t)from[i]] = to[i];
+  }
+};
+
+const CompTable comp;
+
+/*
+ * SIMD complement: for bytes 0x40-0x7F, the low five bits select an
+ * upper-case complement from two 16-entry tables (0 if not a valid code)
+ * and the case bit is carried over.
+ */
+#define COMP_LO_HALF                                                           \
+  0, 'T', 'V', 'G', 'H', 0, 0, 'C', 'D', 0, 0, 'M', 0, 'K', 'N', 0
+#define COMP_HI_HALF                                                           \
+  0, 0, 'Y', 'S', 'A', 'A', 'B', 'W', 0, 'R', 0, 0, 0, 0, 0, 0
+
+#ifdef __SSE2__
+// reverse complement of s[0..32) into out[0..32)
+__attribute__((target("avx2"))) inline void revcomp32(const char *s,
+                                                      char *out) {
+  const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5,
+                                       4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,
+                                       9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i lo = _mm256_setr_epi8(COMP_LO_HALF, COMP_LO_HALF);
+  const __m256i hi = _mm256_setr_epi8(COMP_HI_HALF, COMP_HI_HALF);
+  __m256i x = _mm256_loadu_si256((const __m256i *)s);
+  x = _mm256_shuffle_epi8(x, rev);
+  x = _mm256_permute2x128_si256(x, x, 1);
+  __m256i idx = _mm256_and_si256(x, _mm256_set1_epi8(0x0F));
+  __m256i upper = _mm256_cmpeq_epi8(_mm256_and_si256(x, _mm256_set1_epi8(0x10)),
+                                    _mm256_set1_epi8(0x10));
+  __m256i c = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, idx),
+                                 _mm256_shuffle_epi8(hi, idx), upper);
+  __m256i letter =
+      _mm256_cmpeq_epi8(_mm256_and_si256(x, _mm256_set1_epi8((char)0xC0)),
+                        _mm256_set1_epi8(0x40));
+  letter = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, _mm256_setzero_si256()),
+                               letter);
+  c = _mm256_or_si256(c, _mm256_and_si256(x, _mm256_set1_epi8(0x20)));
+  __m256i keep = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+                                 _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.')));
+  __m256i r = _mm256_blendv_epi8(_mm256_set1_epi8('N'), x, keep);
+  r = _mm256_blendv_epi8(r, c, letter);
+  _mm256_storeu_si256((__m256i *)out, r);
+}
+
+// reverse complements the last 32-byte blocks of s[0..n) into the front
+// of out, returning how many bytes were done
+__attribute__((target("avx2"))) seq_int_t revcompAVX2(const char *s,
+                                                      seq_int_t n,
+                                                      char *out) {
+  seq_int_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    revcomp32(s + (n - i - 32), out + i);
+  return i;
+}
+
+__attribute__((target("ssse3"))) inline void revcomp16(const char *s,
+                                                       char *out) {
+  const __m128i rev =
+      _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i lo = _mm_setr_epi8(COMP_LO_HALF);
+  const __m128i hi = _mm_setr_epi8(COMP_HI_HALF);
+  __m128i x = _mm_loadu_si128((const __m128i *)s);
+  x = _mm_shuffle_epi8(x, rev);
+  __m128i idx = _mm_and_si128(x, _mm_set1_epi8(0x0F));
+  __m128i upper = _mm_cmpeq_epi8(_mm_and_si128(x, _mm_set1_epi8(0x10)),
+                                 _mm_set1_epi8(0x10));
+  __m128i c = _mm_or_si128(
+      _mm_andnot_si128(upper, _mm_shuffle_epi8(lo, idx)),
+      _mm_and_si128(upper, _mm_shuffle_epi8(hi, idx)));
+  __m128i letter = _mm_cmpeq_epi8(_mm_and_si128(x, _mm_set1_epi8((char)0xC0)),
+                                  _mm_set1_epi8(0x40));
+  letter = _mm_andnot_si128(_mm_cmpeq_epi8(c, _mm_setzero_si128()), letter);
+  c = _mm_or_si128(c, _mm_and_si128(x, _mm_set1_epi8(0x20)));
+  __m128i keep = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                              _mm_cmpeq_epi8(x, _mm_set1_epi8('.')));
+  __m128i r = _mm_or_si128(_mm_and_si128(keep, x),
+                           _mm_andnot_si128(keep, _mm_set1_epi8('N')));
+  r = _mm_or_si128(_mm_and_si128(letter, c), _mm_andnot_si128(letter, r));
+  _mm_storeu_si128((__m128i *)out, r);
+}
+
+__attribute__((target("ssse3"))) seq_int_t revcompSSSE3(const char *s,
+                                                        seq_int_t n,
+                                                        char *out) {
+  seq_int_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    revcomp16(s + (n - i - 16), out + i);
+  return i;
+}
+#endif
+
+// IUPAC nucleotide codes (either case) plus '-' and '.'
+struct IUPACTable {
+  bool t[256];
+  IUPACTable() {
+    std::fill(t, t + 256, false);
+    for (const char *c = "ABCDGHKMNRSTUVWY"; *c; c++)
+      t[(uint8_t)*c] = t[(uint8_t)*c | 0x20] = true;
+    t['-'] = t['.'] = true;
+  }
+};
+
+const IUPACTable iupac;
+
+/*
+ * SIMD IUPAC membership: letters are case-folded and split into nibbles;
+ * LO_NIBBLE[lo] has bit 0 set if 0x4<lo> is a valid code and bit 1 if
+ * 0x5<lo> is, and HI_NIBBLE selects the bit for the high nibble.
+ */
+#define IUPAC_LO_NIBBLE 0, 1, 3, 3, 3, 2, 2, 3, 1, 2, 0, 1, 0, 1, 1, 0
+#define IUPAC_HI_NIBBLE 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+
+#ifdef __SSE2__
+// returns the mask of invalid bytes among s[0..32), writing them to out
+// (upper-cased if requested) when out is non-null
+__attribute__((target("avx2"))) inline uint32_t
+validateNT32(const char *s, char *out, bool upper) {
+  const __m256i lo = _mm256_setr_epi8(IUPAC_LO_NIBBLE, IUPAC_LO_NIBBLE);
+  const __m256i hi = _mm256_setr_epi8(IUPAC_HI_NIBBLE, IUPAC_HI_NIBBLE);
+  const __m256i nib = _mm256_set1_epi8(0x0F);
+  __m256i x = _mm256_loadu_si256((const __m256i *)s);
+  __m256i u = _mm256_and_si256(x, _mm256_set1_epi8((char)0xDF));
+  __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(u, nib));
+  __m256i h = _mm256_shuffle_epi8(
+      hi, _mm256_and_si256(_mm256_srli_epi16(u, 4), nib));
+  __m256i letter = _mm256_cmpeq_epi8(_mm256_and_si256(l, h),
+                                     _mm256_setzero_si256());
+  letter = _mm256_xor_si256(letter, _mm256_set1_epi8((char)0xFF));
+  __m256i valid = _mm256_or_si256(
+      letter, _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')),
+                              _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.'))));
+  if (out) {
+    if (upper)
+      x = _mm256_andnot_si256(
+          _mm256_and_si256(letter, _mm256_set1_epi8(0x20)), x);
+    _mm256_storeu_si256((__m256i *)out, x);
+  }
+  return ~(uint32_t)_mm256_movemask_epi8(valid);
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+validateQual32(const char *s, char *out) {
+  __m256i x = _mm256_loadu_si256((const __m256i *)s);
+  // signed compares also reject bytes >= 0x80
+  __m256i valid =
+      _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(0x20)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), x));
+  if (out)
+    _mm256_storeu_si256((__m256i *)out, x);
+  return ~(uint32_t)_mm256_movemask_epi8(valid);
+}
+
+/*
+ * The block validators below stop at the first block holding an invalid
+ * byte and return how many bytes before it are valid; the caller finds
+ * the exact position with a narrower kernel or the scalar loop.
+ */
+__attribute__((target("avx2"))) seq_int_t
+validateNTAVX2(const char *s, seq_int_t n, char *out, bool upper) {
+  seq_int_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    if (validateNT32(s + i, out ? out + i : nullptr, upper))
+      break;
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) seq_int_t
+validateQualAVX2(const char *s, seq_int_t n, char *out) {
+  seq_int_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    if (validateQual32(s + i, out ? out + i : nullptr))
+      break;
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) inline uint32_t
+validateNT16(const char *s, char *out, bool upper) {
+  const __m128i lo = _mm_setr_epi8(IUPAC_LO_NIBBLE);
+  const __m128i hi = _mm_setr_epi8(IUPAC_HI_NIBBLE);
+  const __m128i nib = _mm_set1_epi8(0x0F);
+  __m128i x = _mm_loadu_si128((const __m128i *)s);
+  __m128i u = _mm_and_si128(x, _mm_set1_epi8((char)0xDF));
+  __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(u, nib));
+  __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(u, 4), nib));
+  __m128i letter =
+      _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+  letter = _mm_xor_si128(letter, _mm_set1_epi8((char)0xFF));
+  __m128i valid = _mm_or_si128(
+      letter, _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')),
+                           _mm_cmpeq_epi8(x, _mm_set1_epi8('.'))));
+  if (out) {
+    if (upper)
+      x = _mm_andnot_si128(_mm_and_si128(letter, _mm_set1_epi8(0x20)), x);
+    _mm_storeu_si128((__m128i *)out, x);
+  }
+  return ~(uint32_t)_mm_movemask_epi8(valid) & 0xFFFF;
+}
+
+__attribute__((target("ssse3"))) seq_int_t
+validateNTSSSE3(const char *s, seq_int_t n, char *out, bool upper) {
+  seq_int_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    if (validateNT16(s + i, out ? out + i : nullptr, upper))
+      break;
+  }
+  return i;
+}
+
+inline uint32_t validateQual16(const char *s, char *out) {
+  __m128i x = _mm_loadu_si128((const __m128i *)s);
+  __m128i valid = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(0x20)),
+                                _mm_cmpgt_epi8(_mm_set1_epi8(0x7F), x));
+  if (out)
+    _mm_storeu_si128((__m128i *)out, x);
+  return ~(uint32_t)_mm_movemask_epi8(valid) & 0xFFFF;
+}
+#endif
+
+inline seq_int_t firstSet(uint32_t mask) {
+  seq_int_t i = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    ++i;
+  }
+  return i;
+}
+
+// invertible integer hash restricted to the low bits selected by mask, so
+// distinct k-mers never collide (see Thomas Wang's 64-bit mix)
+inline uint64_t hash64(uint64_t key, uint64_t mask) {
+  key = (~key + (key << 21)) & mask;
+  key = key ^ (key >> 24);
+  key = ((key + (key << 3)) + (key << 8)) & mask;
+  key = key ^ (key >> 14);
+  key = ((key + (key << 2)) + (key << 4)) & mask;
+  key = key ^ (key >> 28);
+  key = (key + (key << 31)) & mask;
+  return key;
+}
+
+inline uint64_t kmerMask(seq_int_t k) {
+  return (k == 32) ? ~0ULL : ((1ULL << (2 * k)) - 1);
+}
+
+// sliding-window minimum over (position, hash) pairs; ties keep the
+// leftmost entry
+class MonoQueue {
+  struct Entry {
+    seq_int_t pos;
+    uint64_t hash;
+    uint64_t val;
+  };
+  std::vector<Entry> ring;
+  seq_int_t head, size;
+
+  Entry &at(seq_int_t i) { return ring[(head + i) % ring.size()]; }
+
+public:
+  explicit MonoQueue(seq_int_t w) : ring(w), head(0), size(0) {}
+
+  void clear() { head = size = 0; }
+
+  void push(seq_int_t pos, uint64_t hash, uint64_t val) {
+    while (size > 0 && at(size - 1).hash > hash)
+      --size;
+    at(size++) = {pos, hash, val};
+  }
+
+  // drops entries left of pos
+  void expire(seq_int_t pos) {
+    while (size > 0 && at(0).pos < pos) {
+      head = (head + 1) % ring.size();
+      --size;
+    }
+  }
+
+  const Entry &front() { return at(0); }
+};
+
+// ntHash per-base seeds, indexed by 2-bit code
+const uint64_t NT_SEEDS[4] = {0x3c8bfbb395c60474ULL, 0x3193c18562a02b4cULL,
+                              0x20323ed082572324ULL, 0x295549f54be24456ULL};
+
+inline uint64_t rol(uint64_t x, unsigned r) {
+  r &= 63;
+  return r ? ((x << r) | (x >> (64 - r))) : x;
+}
+
+inline uint64_t ror(uint64_t x, unsigned r) { return rol(x, 64 - (r & 63)); }
+
+// 2-bit code of the base at relative position i
+inline uint8_t codeAt(seq_t s, seq_int_t i) {
+  if (s.len >= 0)
+    return nt4.t[(uint8_t)s.seq[i]];
+  const uint8_t c = nt4.t[(uint8_t)s.seq[-s.len - i - 1]];
+  return (c < 4) ? (3 - c) : 4;
+}
+
+// encodes n bases of the (possibly reverse complemented) sequence
+// starting at relative position i
+void encodeRange(seq_t s, seq_int_t i, seq_int_t n, uint8_t *out) {
+  if (s.len >= 0) {
+    seq_nt4_encode(s.seq + i, n, out);
+  } else {
+    seq_nt4_encode(s.seq + (-s.len - i - n), n, out);
+    std::reverse(out, out + n);
+    for (seq_int_t j = 0; j < n; j++)
+      out[j] = (out[j] < 4) ? (3 - out[j]) : 4;
+  }
+}
+
+/*
+ * Base histograms: per-byte counters are incremented by subtracting
+ * compare masks, and flushed with psadbw before they can overflow.
+ */
+#ifdef __SSE2__
+__attribute__((target("avx2"))) seq_int_t
+countACGT32(const char *s, seq_int_t n, seq_int_t *counts) {
+  const char bases[4] = {'A', 'C', 'G', 'T'};
+  seq_int_t i = 0;
+  while (i + 32 <= n) {
+    __m256i acc[4];
+    for (int b = 0; b < 4; b++)
+      acc[b] = _mm256_setzero_si256();
+    for (int r = 0; r < 255 && i + 32 <= n; r++, i += 32) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+      x = _mm256_and_si256(x, _mm256_set1_epi8((char)0xDF));
+      for (int b = 0; b < 4; b++)
+        acc[b] = _mm256_sub_epi8(
+            acc[b], _mm256_cmpeq_epi8(x, _mm256_set1_epi8(bases[b])));
+    }
+    for (int b = 0; b < 4; b++) {
+      __m256i sum = _mm256_sad_epu8(acc[b], _mm256_setzero_si256());
+      counts[b] += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+                   _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+    }
+  }
+  return i;
+}
+
+inline seq_int_t countACGT16(const char *s, seq_int_t n, seq_int_t *counts) {
+  const char bases[4] = {'A', 'C', 'G', 'T'};
+  seq_int_t i = 0;
+  while (i + 16 <= n) {
+    __m128i acc[4];
+    for (int b = 0; b < 4; b++)
+      acc[b] = _mm_setzero_si128();
+    for (int r = 0; r < 255 && i + 16 <= n; r++, i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+      x = _mm_and_si128(x, _mm_set1_epi8((char)0xDF));
+      for (int b = 0; b < 4; b++)
+        acc[b] = _mm_sub_epi8(acc[b],
+                              _mm_cmpeq_epi8(x, _mm_set1_epi8(bases[b])));
+    }
+    for (int b = 0; b < 4; b++) {
+      __m128i sum = _mm_sad_epu8(acc[b], _mm_setzero_si128());
+      counts[b] += _mm_cvtsi128_si64(sum) +
+                   _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+    }
+  }
+  return i;
+}
+#endif
+} // namespace
+
+SEQ_FUNC void seq_nt4_encode(const char *s, seq_int_t n, uint8_t *out) {
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const int level = simd();
+  if (level >= SIMD_AVX2)
+    i = encodeAVX2(s, n, out);
+  if (level >= SIMD_SSE2) {
+    for (; i + 16 <= n; i += 16)
+      encode16(s + i, out + i);
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = nt4.t[(uint8_t)s[i]];
+}
+
+SEQ_FUNC void seq_revcomp(const char *s, seq_int_t n, char *out) {
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const int level = simd();
+  if (level >= SIMD_AVX2)
+    i = revcompAVX2(s, n, out);
+  if (level >= SIMD_SSSE3)
+    i += revcompSSSE3(s, n - i, out + i);
+#endif
+  for (; i < n; i++)
+    out[i] = comp.t[(uint8_t)s[n - i - 1]];
+}
+
+SEQ_FUNC void seq_base_counts(const char *s, seq_int_t n, seq_int_t *counts) {
+  seq_int_t acgt[4] = {0, 0, 0, 0};
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const int level = simd();
+  if (level >= SIMD_AVX2)
+    i += countACGT32(s + i, n - i, acgt);
+  if (level >= SIMD_SSE2)
+    i += countACGT16(s + i, n - i, acgt);
+#endif
+  for (; i < n; i++) {
+    const uint8_t c = nt4.t[(uint8_t)s[i]];
+    if (c < 4)
+      ++acgt[c];
+  }
+  for (int b = 0; b < 4; b++)
+    counts[b] += acgt[b];
+  counts[4] += n - (acgt[0] + acgt[1] + acgt[2] + acgt[3]);
+}
+
+SEQ_FUNC seq_int_t seq_find_ambiguous(const char *s, seq_int_t n) {
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const bool vector = simd() >= SIMD_SSE2;
+  for (; vector && i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+    x = _mm_and_si128(x, _mm_set1_epi8((char)0xDF));
+    __m128i valid =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('A')),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8('C'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('G')),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8('T'))));
+    const uint32_t bad = ~(uint32_t)_mm_movemask_epi8(valid) & 0xFFFF;
+    if (bad)
+      return i + firstSet(bad);
+  }
+#endif
+  for (; i < n; i++) {
+    if (nt4.t[(uint8_t)s[i]] > 3)
+      return i;
+  }
+  return -1;
+}
+
+SEQ_FUNC void seq_position_counts(seq_t s, seq_int_t *counts, seq_int_t len) {
+  const seq_int_t n = std::min(s.len < 0 ? -s.len : s.len, len);
+  uint8_t buf[NT_BLOCK];
+  for (seq_int_t i = 0; i < n; i += NT_BLOCK) {
+    const seq_int_t m = std::min(NT_BLOCK, n - i);
+    encodeRange(s, i, m, buf);
+    // one pass per code keeps each loop a vectorizable compare-and-add
+    for (uint8_t c = 0; c < 5; c++) {
+      seq_int_t *row = counts + c * len + i;
+      for (seq_int_t j = 0; j < m; j++)
+        row[j] += (buf[j] == c);
+    }
+  }
+}
+
+SEQ_FUNC seq_int_t seq_validate_nt(const char *s, seq_int_t n, char *out,
+                                   bool upper) {
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const int level = simd();
+  if (level >= SIMD_AVX2)
+    i = validateNTAVX2(s, n, out, upper);
+  if (level >= SIMD_SSSE3)
+    i += validateNTSSSE3(s + i, n - i, out ? out + i : nullptr, upper);
+#endif
+  for (; i < n; i++) {
+    const uint8_t c = (uint8_t)s[i];
+    if (!iupac.t[c])
+      return i;
+    if (out)
+      out[i] = (upper && c >= 'a') ? (char)(c & 0xDF) : (char)c;
+  }
+  return -1;
+}
+
+SEQ_FUNC seq_int_t seq_strip_newlines(const char *s, seq_int_t n, char *out) {
+  seq_int_t i = 0, j = 0;
+#ifdef __SSE2__
+  // whole vectors are stored even when they hold a newline; the bytes
+  // past it are overwritten next, and j <= i keeps stores within n
+  const __m128i nl = _mm_set1_epi8('\n');
+  const bool vector = simd() >= SIMD_SSE2;
+  while (vector && i + 16 <= n) {
+    const __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+    const uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, nl));
+    _mm_storeu_si128((__m128i *)(out + j), x);
+    if (mask) {
+      const seq_int_t k = firstSet(mask);
+      i += k + 1;
+      j += k;
+    } else {
+      i += 16;
+      j += 16;
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (s[i] != '\n')
+      out[j++] = s[i];
+  }
+  return j;
+}
+
+SEQ_FUNC seq_int_t seq_validate_qual(const char *s, seq_int_t n, char *out) {
+  seq_int_t i = 0;
+#ifdef __SSE2__
+  const int level = simd();
+  if (level >= SIMD_AVX2)
+    i = validateQualAVX2(s, n, out);
+  for (; level >= SIMD_SSE2 && i + 16 <= n; i += 16) {
+    const uint32_t bad = validateQual16(s + i, out ? out + i : nullptr);
+    if (bad)
+      return i + firstSet(bad);
+  }
+#endif
+  for (; i < n; i++) {
+    const uint8_t c = (uint8_t)s[i];
+    if (c < 0x21 || c > 0x7E)
+      return i;
+    if (out)
+      out[i] = (char)c;
+  }
+  return -1;
+}
+
+SEQ_FUNC seq_int_t seq_kmers_block(seq_t s, seq_int_t k, seq_int_t step,
+                                   bool canonical, seq_int_t *next,
+                                   uint64_t *kmers, seq_int_t *pos,
+                                   seq_int_t cap) {
+  const seq_int_t n = (s.len >= 0) ? s.len : -s.len;
+  const uint64_t mask = kmerMask(k);
+  const unsigned shift = 2 * (k - 1);
+  uint8_t codes[NT_BLOCK];
+  uint64_t fwd = 0, rev = 0;
+  seq_int_t valid = 0; // trailing unambiguous bases seen
+  seq_int_t count = 0;
+  seq_int_t p = *next;
+
+  while (count < cap && p < n) {
+    const seq_int_t m = std::min(NT_BLOCK, n - p);
+    encodeRange(s, p, m, codes);
+    for (seq_int_t j = 0; j < m; j++) {
+      const uint8_t c = codes[j];
+      if (c > 3) {
+        valid = 0;
+        continue;
+      }
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((uint64_t)(3 - c) << shift);
+      if (++valid < k)
+        continue;
+      const seq_int_t start = p + j - k + 1;
+      if (step != 1 && start % step != 0)
+        continue;
+      kmers[count] = (canonical && rev < fwd) ? rev : fwd;
+      pos[count] = start;
+      if (++count == cap) {
+        *next = start + step;
+        return count;
+      }
+    }
+    p += m;
+  }
+
+  *next = n;
+  return count;
+}
+
+SEQ_FUNC seq_int_t seq_minimizers_block(seq_t s, seq_int_t k, seq_int_t w,
+                                        uint64_t seed, bool canonical,
+                                        seq_int_t *next, seq_int_t *last,
+                                        uint64_t *kmers, seq_int_t *pos,
+                                        seq_int_t cap) {
+  const seq_int_t n = (s.len >= 0) ? s.len : -s.len;
+  const uint64_t mask = kmerMask(k);
+  const unsigned shift = 2 * (k - 1);
+  uint8_t codes[NT_BLOCK];
+  MonoQueue queue(w);
+  uint64_t fwd = 0, rev = 0;
+  seq_int_t valid = 0; // trailing unambiguous bases seen
+  seq_int_t run = 0;   // consecutive k-mers in the queue's current run
+  seq_int_t count = 0;
+  seq_int_t p = *next;
+
+  while (count < cap && p < n) {
+    const seq_int_t m = std::min(NT_BLOCK, n - p);
+    encodeRange(s, p, m, codes);
+    for (seq_int_t j = 0; j < m; j++) {
+      const uint8_t c = codes[j];
+      if (c > 3) {
+        valid = run = 0;
+        queue.clear();
+        continue;
+      }
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((uint64_t)(3 - c) << shift);
+      if (++valid < k)
+        continue;
+      // selection is strand-independent: order by the canonical k-mer
+      const seq_int_t start = p + j - k + 1;
+      const uint64_t can = (rev < fwd) ? rev : fwd;
+      const seq_int_t window = start - w + 1;
+      queue.expire(window);
+      queue.push(start, hash64(can ^ seed, mask), canonical ? can : fwd);
+      if (++run < w)
+        continue;
+      if (queue.front().pos <= *last)
+        continue;
+      kmers[count] = queue.front().val;
+      pos[count] = *last = queue.front().pos;
+      if (++count == cap) {
+        *next = window + 1;
+        return count;
+      }
+    }
+    p += m;
+  }
+
+  *next = n;
+  return count;
+}
+
+SEQ_FUNC seq_int_t seq_syncmers_block(seq_t s, seq_int_t k, seq_int_t sl,
+                                      seq_int_t t, uint64_t seed,
+                                      bool canonical, seq_int_t *next,
+                                      uint64_t *kmers, seq_int_t *pos,
+                                      seq_int_t cap) {
+  const seq_int_t n = (s.len >= 0) ? s.len : -s.len;
+  const uint64_t mask = kmerMask(k), smask = kmerMask(sl);
+  const unsigned shift = 2 * (k - 1), sshift = 2 * (sl - 1);
+  uint8_t codes[NT_BLOCK];
+  MonoQueue queue(k - sl + 1);
+  uint64_t fwd = 0, rev = 0, sfwd = 0, srev = 0;
+  seq_int_t valid = 0; // trailing unambiguous bases seen
+  seq_int_t count = 0;
+  seq_int_t p = *next;
+
+  while (count < cap && p < n) {
+    const seq_int_t m = std::min(NT_BLOCK, n - p);
+    encodeRange(s, p, m, codes);
+    for (seq_int_t j = 0; j < m; j++) {
+      const uint8_t c = codes[j];
+      if (c > 3) {
+        valid = 0;
+        queue.clear();
+        continue;
+      }
+      fwd = ((fwd << 2) | c) & mask;
+      rev = (rev >> 2) | ((uint64_t)(3 - c) << shift);
+      sfwd = ((sfwd << 2) | c) & smask;
+      srev = (srev >> 2) | ((uint64_t)(3 - c) << sshift);
+      const seq_int_t start = p + j - k + 1;
+      if (++valid >= sl) {
+        const uint64_t can = (srev < sfwd) ? srev : sfwd;
+        queue.expire(start);
+        queue.push(p + j - sl + 1, hash64(can ^ seed, smask), 0);
+      }
+      if (valid < k)
+        continue;
+      if (queue.front().pos - start != t)
+        continue;
+      kmers[count] = (canonical && rev < fwd) ? rev : fwd;
+      pos[count] = start;
+      if (++count == cap) {
+        *next = start + 1;
+        return count;
+      }
+    }
+    p += m;
+  }
+
+  *next = n;
+  return count;
+}
+
+// state: {next base to feed, trailing unambiguous bases, forward hash,
+//         reverse-complement hash}
+SEQ_FUNC seq_int_t seq_nthash_block(seq_t s, seq_int_t k, bool canonical,
+                                    uint64_t *state, uint64_t *hashes,
+                                    seq_int_t *pos, seq_int_t cap) {
+  const seq_int_t n = (s.len >= 0) ? s.len : -s.len;
+  uint8_t codes[NT_BLOCK];
+  seq_int_t p = (seq_int_t)state[0];
+  seq_int_t valid = (seq_int_t)state[1];
+  uint64_t fwd = state[2], rev = state[3];
+  seq_int_t count = 0;
+
+  while (count < cap && p < n) {
+    const seq_int_t m = std::min(NT_BLOCK, n - p);
+    encodeRange(s, p, m, codes);
+    seq_int_t j = 0;
+    for (; j < m && count < cap; j++) {
+      const uint8_t c = codes[j];
+      if (c > 3) {
+        valid = 0;
+        fwd = rev = 0;
+        continue;
+      }
+      if (valid < k) {
+        fwd = rol(fwd, 1) ^ NT_SEEDS[c];
+        rev ^= rol(NT_SEEDS[3 - c], valid);
+        if (++valid < k)
+          continue;
+      } else {
+        const uint8_t out = codeAt(s, p + j - k);
+        fwd = rol(fwd, 1) ^ rol(NT_SEEDS[out], k) ^ NT_SEEDS[c];
+        rev = ror(rev, 1) ^ ror(NT_SEEDS[3 - out], 1) ^
+              rol(NT_SEEDS[3 - c], k - 1);
+      }
+      hashes[count] = (canonical && rev < fwd) ? rev : fwd;
+      pos[count++] = p + j - k + 1;
+    }
+    p += j;
+  }
+
+  state[0] = (uint64_t)p;
+  state[1] = (uint64_t)valid;
+  state[2] = fwd;
+  state[3] = rev;
+  return count;
+}
+
+SEQ_FUNC seq_int_t seq_simd_limit(seq_int_t level) {
+  if (level < 0 || level > simdSupported)
+    level = simdSupported;
+  simdLevel.store((int)level);
+  return level;
+}
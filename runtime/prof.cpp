@@ -0,0 +1,429 @@
+#include "lib.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Function-level profiler used by "seqc -prof"
+ *
+ * The compiler instruments every function with calls to seq_prof_enter on
+ * entry and seq_prof_exit before returning, passing the function's name. Each
+ * thread builds its own call tree, recording call counts and inclusive time
+ * per node. On exit, the trees are written out in the "folded stacks" format
+ * understood by flame graph tools, and a per-function summary is printed.
+ */
+
+namespace {
+struct ProfNode {
+  const char *name;
+  std::vector<ProfNode *> children;
+  uint64_t calls;
+  uint64_t total; // inclusive time in nanoseconds
+
+  explicit ProfNode(const char *name)
+      : name(name), children(), calls(0), total(0) {}
+
+  ProfNode *child(const char *name) {
+    for (ProfNode *node : children) {
+      if (node->name == name)
+        return node;
+    }
+    auto *node = new ProfNode(name);
+    children.push_back(node);
+    return node;
+  }
+
+  uint64_t self() const {
+    uint64_t sub = 0;
+    for (ProfNode *node : children)
+      sub += node->total;
+    return total > sub ? total - sub : 0;
+  }
+};
+
+struct ProfFrame {
+  ProfNode *node;
+  uint64_t start;
+};
+
+struct ProfThread {
+  ProfNode root;
+  std::vector<ProfFrame> stack;
+
+  ProfThread() : root(nullptr), stack() {}
+};
+
+struct ProfSummary {
+  uint64_t calls;
+  uint64_t self;
+  uint64_t total;
+};
+} // namespace
+
+static std::mutex profLock;
+static std::vector<ProfThread *> profThreads;
+static thread_local ProfThread *profThread = nullptr;
+
+static uint64_t profNow() {
+  auto duration = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             duration)
+      .count();
+}
+
+static void profWriteFolded(FILE *out, ProfNode *node, std::string &path) {
+  const size_t len = path.size();
+  if (node->name) {
+    if (!path.empty())
+      path += ';';
+    path += node->name;
+    const uint64_t self = node->self();
+    if (self > 0)
+      fprintf(out, "%s %llu\n", path.c_str(), (unsigned long long)self);
+  }
+  for (ProfNode *child : node->children)
+    profWriteFolded(out, child, path);
+  path.resize(len);
+}
+
+static void profSummarize(ProfNode *node,
+                          std::unordered_map<std::string, ProfSummary> &summary,
+                          std::unordered_map<std::string, int> &active) {
+  std::string name;
+  if (node->name) {
+    name = node->name;
+    ProfSummary &s = summary[name];
+    s.calls += node->calls;
+    s.self += node->self();
+    // don't count time spent in recursive calls twice
+    if (active[name]++ == 0)
+      s.total += node->total;
+  }
+  for (ProfNode *child : node->children)
+    profSummarize(child, summary, active);
+  if (node->name)
+    --active[name];
+}
+
+static void profReport() {
+  std::lock_guard<std::mutex> guard(profLock);
+  const uint64_t now = profNow();
+
+  // close frames that are still open (e.g. if exit() was called)
+  for (ProfThread *t : profThreads) {
+    for (ProfFrame &frame : t->stack)
+      frame.node->total += now - frame.start;
+    t->stack.clear();
+  }
+
+  char file[64];
+  snprintf(file, sizeof(file), "seq.%d.prof", (int)getpid());
+  FILE *out = fopen(file, "w");
+  if (!out) {
+    fprintf(stderr, "error: could not write profile to %s: %s\n", file,
+            strerror(errno));
+    return;
+  }
+
+  std::unordered_map<std::string, ProfSummary> summary;
+  for (ProfThread *t : profThreads) {
+    std::string path;
+    std::unordered_map<std::string, int> active;
+    profWriteFolded(out, &t->root, path);
+    profSummarize(&t->root, summary, active);
+  }
+  fclose(out);
+
+  std::vector<std::pair<std::string, ProfSummary>> rows(summary.begin(),
+                                                        summary.end());
+  std::sort(rows.begin(), rows.end(),
+            [](const std::pair<std::string, ProfSummary> &a,
+               const std::pair<std::string, ProfSummary> &b) {
+              return a.second.self > b.second.self;
+            });
+
+  const size_t limit = 25;
+  fprintf(stderr, "\n\033[1mprofile:\033[0m (folded stacks written to %s)\n",
+          file);
+  fprintf(stderr, "%12s %12s %12s  %s\n", "self (ms)", "total (ms)", "calls",
+          "function");
+  for (size_t i = 0; i < rows.size() && i < limit; i++) {
+    const ProfSummary &s = rows[i].second;
+    fprintf(stderr, "%12.3f %12.3f %12llu  %s\n", s.self / 1e6, s.total / 1e6,
+            (unsigned long long)s.calls, rows[i].first.c_str());
+  }
+}
+
+static ProfThread *profRegisterThread() {
+  static std::once_flag reportFlag;
+  std::call_once(reportFlag, []() { atexit(profReport); });
+
+  profThread = new ProfThread();
+  std::lock_guard<std::mutex> guard(profLock);
+  profThreads.push_back(profThread);
+  return profThread;
+}
+
+SEQ_FUNC void seq_prof_enter(const char *name) {
+  ProfThread *t = profThread ? profThread : profRegisterThread();
+  ProfNode *parent = t->stack.empty() ? &t->root : t->stack.back().node;
+  ProfNode *node = parent->child(name);
+  ++node->calls;
+  t->stack.push_back({node, profNow()});
+}
+
+SEQ_FUNC void seq_prof_exit(const char *name) {
+  ProfThread *t = profThread;
+  if (!t)
+    return;
+
+  auto it = std::find_if(t->stack.rbegin(), t->stack.rend(),
+                         [name](const ProfFrame &f) {
+                           return f.node->name == name;
+                         });
+  if (it == t->stack.rend())
+    return;
+
+  // frames above the matching one were unwound by an exception
+  const uint64_t now = profNow();
+  const size_t depth = t->stack.rend() - it - 1;
+  while (t->stack.size() > depth) {
+    ProfFrame &frame = t->stack.back();
+    frame.node->total += now - frame.start;
+    t->stack.pop_back();
+  }
+}
+
+/*
+ * Pipeline statistics used by "seqc -pipestats"
+ *
+ * Each stage of an instrumented pipeline counts its inputs and outputs, as
+ * well as the cycles spent in it. Since stages are fused into a single loop
+ * nest, cycles are attributed by recording which stage control was last
+ * transferred to. The prefetch and inter-sequence alignment schedulers also
+ * record how full their batches were when they were processed, and the time
+ * spent draining them at the end of the pipeline gets its own row. Counters
+ * are kept per thread and summed up on exit.
+ */
+
+namespace {
+struct PipeStageStats {
+  uint64_t in;
+  uint64_t out;
+  uint64_t cycles;
+  uint64_t batches;
+  uint64_t filled;
+  uint64_t capacity;
+};
+
+struct PipeThreadStats {
+  std::vector<PipeStageStats> stages;
+  seq_int_t current; // stage control was last transferred to, or -1
+  uint64_t last;     // cycle count at that point
+
+  explicit PipeThreadStats(size_t n)
+      : stages(n, PipeStageStats()), current(-1), last(0) {}
+};
+
+struct PipeStats {
+  std::string id;
+  std::vector<std::string> names; // last one is the drain step
+  std::vector<PipeThreadStats *> threads;
+  std::mutex lock;
+};
+
+struct PipeThreadCache {
+  PipeStats *stats;
+  PipeThreadStats *data;
+};
+} // namespace
+
+static std::mutex pipeLock;
+static std::vector<PipeStats *> pipeStats;
+static thread_local std::unordered_map<PipeStats *, PipeThreadStats *>
+    pipeThreadStats;
+static thread_local PipeThreadCache pipeThreadCache = {nullptr, nullptr};
+
+static uint64_t pipeCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return profNow();
+#endif
+}
+
+static std::string jsonEscape(const std::string &s) {
+  std::string result;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      result += '\\';
+    result += c;
+  }
+  return result;
+}
+
+static void pipeReport() {
+  std::lock_guard<std::mutex> guard(pipeLock);
+  const char *jsonFile = getenv("SEQ_PIPESTATS_JSON");
+  FILE *json = jsonFile ? fopen(jsonFile, "w") : nullptr;
+  if (jsonFile && !json)
+    fprintf(stderr, "error: could not write pipeline statistics to %s: %s\n",
+            jsonFile, strerror(errno));
+  if (json)
+    fprintf(json, "[");
+
+  for (size_t p = 0; p < pipeStats.size(); p++) {
+    PipeStats *stats = pipeStats[p];
+    std::lock_guard<std::mutex> statsGuard(stats->lock);
+    const size_t n = stats->names.size();
+    std::vector<PipeStageStats> total(n, PipeStageStats());
+    uint64_t cycles = 0;
+    for (PipeThreadStats *t : stats->threads) {
+      for (size_t i = 0; i < n; i++) {
+        const PipeStageStats &s = t->stages[i];
+        total[i].in += s.in;
+        total[i].out += s.out;
+        total[i].cycles += s.cycles;
+        total[i].batches += s.batches;
+        total[i].filled += s.filled;
+        total[i].capacity += s.capacity;
+        cycles += s.cycles;
+      }
+    }
+
+    fprintf(stderr, "\n\033[1mpipeline %s\033[0m (%zu thread%s)\n",
+            stats->id.c_str(), stats->threads.size(),
+            stats->threads.size() == 1 ? "" : "s");
+    fprintf(stderr, "  %-24s %12s %12s %16s %7s %10s %7s\n", "stage", "in",
+            "out", "cycles", "time", "batches", "fill");
+    for (size_t i = 0; i < n; i++) {
+      const PipeStageStats &s = total[i];
+      if (i == n - 1 && s.cycles == 0 && s.batches == 0)
+        continue; // no drain step
+      fprintf(stderr, "  %-24s %12llu %12llu %16llu %6.1f%% %10llu",
+              stats->names[i].c_str(), (unsigned long long)s.in,
+              (unsigned long long)s.out, (unsigned long long)s.cycles,
+              cycles ? 100.0 * s.cycles / cycles : 0.0,
+              (unsigned long long)s.batches);
+      if (s.capacity)
+        fprintf(stderr, " %6.1f%%\n", 100.0 * s.filled / s.capacity);
+      else
+        fprintf(stderr, " %7s\n", "-");
+    }
+
+    if (!json)
+      continue;
+    fprintf(json, "%s\n {\"pipeline\": \"%s\", \"stages\": [", p ? "," : "",
+            jsonEscape(stats->id).c_str());
+    for (size_t i = 0; i < n; i++) {
+      fprintf(json, "%s\n  {\"name\": \"%s\", \"threads\": [", i ? "," : "",
+              jsonEscape(stats->names[i]).c_str());
+      for (size_t j = 0; j < stats->threads.size(); j++) {
+        const PipeStageStats &s = stats->threads[j]->stages[i];
+        fprintf(json,
+                "%s{\"in\": %llu, \"out\": %llu, \"cycles\": %llu, "
+                "\"batches\": %llu, \"filled\": %llu, \"capacity\": %llu}",
+                j ? ", " : "", (unsigned long long)s.in,
+                (unsigned long long)s.out, (unsigned long long)s.cycles,
+                (unsigned long long)s.batches, (unsigned long long)s.filled,
+                (unsigned long long)s.capacity);
+      }
+      fprintf(json, "]}");
+    }
+    fprintf(json, "\n ]}");
+  }
+
+  if (json) {
+    fprintf(json, "\n]\n");
+    fclose(json);
+  }
+}
+
+static PipeThreadStats *pipeThread(void *p) {
+  auto *stats = (PipeStats *)p;
+  if (pipeThreadCache.stats == stats)
+    return pipeThreadCache.data;
+
+  PipeThreadStats *&data = pipeThreadStats[stats];
+  if (!data) {
+    data = new PipeThreadStats(stats->names.size());
+    std::lock_guard<std::mutex> guard(stats->lock);
+    stats->threads.push_back(data);
+  }
+  pipeThreadCache = {stats, data};
+  return data;
+}
+
+static void pipeSwitch(PipeThreadStats *t, seq_int_t stage) {
+  const uint64_t now = pipeCycles();
+  if (t->current >= 0)
+    t->stages[t->current].cycles += now - t->last;
+  t->current = stage;
+  t->last = now;
+}
+
+// Compiled code calls this only the first time a pipeline runs and keeps the
+// handle. Looking it up by id still merges threads that race on that first
+// run and copies of the pipeline in separately compiled modules.
+SEQ_FUNC void *seq_pipe_stats(const char *id, const char **names,
+                              seq_int_t n) {
+  static std::once_flag reportFlag;
+  std::call_once(reportFlag, []() { atexit(pipeReport); });
+
+  std::lock_guard<std::mutex> guard(pipeLock);
+  for (PipeStats *stats : pipeStats) {
+    if (stats->id == id)
+      return stats;
+  }
+
+  auto *stats = new PipeStats();
+  stats->id = id;
+  for (seq_int_t i = 0; i < n; i++)
+    stats->names.push_back(std::to_string(i) + " " + names[i]);
+  stats->names.push_back("(drain)");
+  pipeStats.push_back(stats);
+  return stats;
+}
+
+SEQ_FUNC void seq_pipe_start(void *stats) {
+  PipeThreadStats *t = pipeThread(stats);
+  t->current = -1;
+  t->last = pipeCycles();
+}
+
+SEQ_FUNC void seq_pipe_stop(void *stats) { pipeSwitch(pipeThread(stats), -1); }
+
+SEQ_FUNC void seq_pipe_stage(void *stats, seq_int_t stage) {
+  PipeThreadStats *t = pipeThread(stats);
+  pipeSwitch(t, stage);
+  ++t->stages[stage].in;
+}
+
+SEQ_FUNC void seq_pipe_resume(void *stats, seq_int_t stage) {
+  pipeSwitch(pipeThread(stats), stage);
+}
+
+SEQ_FUNC void seq_pipe_yield(void *stats, seq_int_t stage) {
+  ++pipeThread(stats)->stages[stage].out;
+}
+
+SEQ_FUNC void seq_pipe_batch(void *stats, seq_int_t stage, seq_int_t filled,
+                             seq_int_t capacity) {
+  PipeStageStats &s = pipeThread(stats)->stages[stage];
+  ++s.batches;
+  s.filled += filled;
+  s.capacity += capacity;
+}
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "lib.h"
+#include "wakeup.h"
+
+/*
+ * Read-ahead for files that cannot be memory-mapped (pipes, FIFOs, etc.)
+ *
+ * A dedicated I/O thread keeps a ring of buffers filled from the stream's
+ * file descriptor ahead of the reader, so that a parser only waits on the
+ * disk or network when it has consumed everything already read. Each buffer
+ * holds whatever one read returned, so data from a slow pipe is handed over
+ * as soon as it arrives. The reader never touches the descriptor while the
+ * thread runs; seeking stops the thread, repositions the descriptor and
+ * starts it again. Stopping wakes the thread up if it is waiting for input.
+ */
+
+namespace {
+class ReadAhead {
+  struct Buffer {
+    std::vector<char> data;
+    size_t len;
+  };
+
+  int fd;
+  std::vector<Buffer> ring;
+  std::mutex lock;
+  std::condition_variable filled;  // a buffer was filled, or input ended
+  std::condition_variable drained; // a buffer was released, or stopping
+  uint64_t nextIn, nextOut;        // buffers filled and released so far
+  bool done, failed, stop;
+  Wakeup wakeup;
+  std::thread io;
+
+  // reader side
+  size_t curPos;
+  seq_int_t pos;
+
+  void run() {
+    for (;;) {
+      Buffer *b;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        drained.wait(l,
+                     [this] { return stop || nextIn - nextOut < ring.size(); });
+        if (stop)
+          return;
+        b = &ring[nextIn % ring.size()];
+      }
+      ssize_t n = -1;
+      while (wakeup.wait(fd)) {
+        n = ::read(fd, b->data.data(), b->data.size());
+        if (n >= 0 || (errno != EINTR && errno != EAGAIN))
+          break;
+      }
+      std::lock_guard<std::mutex> l(lock);
+      if (stop)
+        return;
+      if (n > 0) {
+        b->len = (size_t)n;
+        ++nextIn;
+      } else {
+        done = true;
+        failed = n < 0;
+      }
+      filled.notify_one();
+      if (done)
+        return;
+    }
+  }
+
+  void start() {
+    nextIn = nextOut = 0;
+    done = failed = stop = false;
+    curPos = 0;
+    io = std::thread(&ReadAhead::run, this);
+  }
+
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      stop = true;
+    }
+    drained.notify_all();
+    wakeup.signal();
+    io.join();
+    wakeup.reset();
+  }
+
+public:
+  ReadAhead(FILE *fp, seq_int_t buffers, seq_int_t size)
+      : fd(fileno(fp)), ring(buffers > 0 ? buffers : 1), nextIn(0),
+        nextOut(0), done(false), failed(false), stop(false), wakeup(), io(),
+        curPos(0), pos(lseek(fd, 0, SEEK_CUR)) {
+    if (pos < 0)
+      pos = 0;
+    for (auto &b : ring) {
+      b.data.resize(size > 0 ? size : 1 << 20);
+      b.len = 0;
+    }
+    start();
+  }
+
+  ~ReadAhead() { shutdown(); }
+
+  // waits for some data, then returns as much as has been read ahead, up to
+  // `n` bytes; returns 0 at end of input and -1 on error
+  seq_int_t read(char *buf, seq_int_t n) {
+    seq_int_t total = 0;
+    while (total < n) {
+      Buffer *b;
+      {
+        std::unique_lock<std::mutex> l(lock);
+        if (total > 0 && nextOut == nextIn)
+          break;
+        filled.wait(l, [this] { return nextOut < nextIn || done; });
+        if (nextOut == nextIn) {
+          if (failed && total == 0)
+            return -1;
+          break;
+        }
+        b = &ring[nextOut % ring.size()];
+      }
+      const size_t k = std::min((size_t)(n - total), b->len - curPos);
+      memcpy(buf + total, b->data.data() + curPos, k);
+      curPos += k;
+      total += k;
+      if (curPos == b->len) {
+        std::lock_guard<std::mutex> l(lock);
+        ++nextOut;
+        curPos = 0;
+        drained.notify_one();
+      }
+    }
+    pos += total;
+    return total;
+  }
+
+  seq_int_t tell() const { return pos; }
+
+  int seek(seq_int_t offset, int whence) {
+    shutdown();
+    if (whence == SEEK_CUR) {
+      offset += pos;
+      whence = SEEK_SET;
+    }
+    const off_t now = lseek(fd, offset, whence);
+    if (now >= 0)
+      pos = now;
+    start();
+    return now >= 0 ? 0 : -1;
+  }
+};
+} // namespace
+
+SEQ_FUNC void *seq_readahead_open(void *fp, seq_int_t buffers,
+                                  seq_int_t size) {
+  return new ReadAhead((FILE *)fp, buffers, size);
+}
+
+SEQ_FUNC seq_int_t seq_readahead_read(void *ra, char *buf, seq_int_t n) {
+  return ((ReadAhead *)ra)->read(buf, n);
+}
+
+SEQ_FUNC seq_int_t seq_readahead_tell(void *ra) {
+  return ((ReadAhead *)ra)->tell();
+}
+
+SEQ_FUNC seq_int_t seq_readahead_seek(void *ra, seq_int_t offset,
+                                      seq_int_t whence) {
+  return ((ReadAhead *)ra)->seek(offset, (int)whence);
+}
+
+SEQ_FUNC void seq_readahead_close(void *ra) { delete (ReadAhead *)ra; }
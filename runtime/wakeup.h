@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * Lets a thread that waits on input from a file descriptor be woken up
+ * when it should stop, so that stopping never blocks on a pipe or FIFO
+ * whose writer is idle. The waiting thread polls the descriptor together
+ * with the read end of a self-pipe, which `signal` writes to.
+ */
+class Wakeup {
+  int fds[2];
+
+public:
+  Wakeup() {
+    if (pipe(fds) != 0)
+      fds[0] = fds[1] = -1; // poll ignores negative descriptors
+  }
+
+  ~Wakeup() {
+    if (fds[0] >= 0) {
+      close(fds[0]);
+      close(fds[1]);
+    }
+  }
+
+  Wakeup(const Wakeup &) = delete;
+  Wakeup &operator=(const Wakeup &) = delete;
+
+  // waits until `fd` can be read without blocking; returns false if woken
+  // by `signal` instead
+  bool wait(int fd) {
+    struct pollfd p[2] = {{fd, POLLIN, 0}, {fds[0], POLLIN, 0}};
+    while (poll(p, 2, -1) < 0) {
+      if (errno != EINTR)
+        return true; // let the read itself report the error
+    }
+    return p[1].revents == 0;
+  }
+
+  // wakes up the waiting thread, now and in any later `wait`
+  void signal() {
+    const char c = 0;
+    if (fds[1] >= 0 && write(fds[1], &c, 1) < 0) {
+    }
+  }
+
+  // undoes `signal` once the woken thread has been joined
+  void reset() {
+    char c;
+    if (fds[0] >= 0 && read(fds[0], &c, 1) < 0) {
+    }
+  }
+};
@@ -14,6 +14,7 @@
 
 #include "lang/seq.h"
 #include "parser/parser.h"
+#include "util/jit.h"
 #include "gtest/gtest.h"
 
 using namespace seq;
@@ -25,8 +26,11 @@ protected:
   vector<char> buf;
   int out_pipe[2];
   pid_t pid;
+  unsigned codegenThreads;
+  bool tiered;
 
-  SeqTest() : buf(65536), out_pipe(), pid() {}
+  SeqTest()
+      : buf(65536), out_pipe(), pid(), codegenThreads(1), tiered(false) {}
 
   string filename() {
     const string basename = get<0>(GetParam());
@@ -46,6 +50,8 @@ protected:
       close(out_pipe[0]);
       close(out_pipe[1]);
 
+      config::config().codegenThreads = codegenThreads;
+      config::config().tiered = tiered;
       SeqModule *module = parse("", filename(), false, false);
       execute(module, {filename()}, {}, debug);
       fflush(stdout);
@@ -63,6 +69,20 @@ protected:
   }
 
   string result() { return string(buf.data()); }
+
+  void runAndCheck();
+};
+
+// same programs, compiled as split modules on several codegen threads
+class SeqParallelCodegenTest : public SeqTest {
+protected:
+  SeqParallelCodegenTest() : SeqTest() { codegenThreads = 4; }
+};
+
+// same programs, with hot functions recompiled in the background as they run
+class SeqTieredTest : public SeqTest {
+protected:
+  SeqTieredTest() : SeqTest() { tiered = true; }
 };
 
 vector<string> splitLines(const string &output) {
@@ -120,7 +140,7 @@ getTestNameFromParam(const testing::TestParamInfo<SeqTest::ParamType> &info) {
   return normname + (debug ? "_debug" : "");
 }
 
-TEST_P(SeqTest, Run) {
+void SeqTest::runAndCheck() {
   const int status = runInChildProcess();
   ASSERT_TRUE(WIFEXITED(status));
   ASSERT_EQ(WEXITSTATUS(status), 0);
@@ -141,6 +161,66 @@ TEST_P(SeqTest, Run) {
   }
 }
 
+TEST_P(SeqTest, Run) { runAndCheck(); }
+
+TEST_P(SeqParallelCodegenTest, Run) { runAndCheck(); }
+
+TEST_P(SeqTieredTest, Run) { runAndCheck(); }
+
+// Runs the given REPL inputs in a child process, followed by a line with
+// whether any function was reused and promoted, and returns the output.
+static string runREPL(const vector<string> &inputs) {
+  vector<char> buf(65536);
+  int out_pipe[2];
+  assert(pipe(out_pipe) != -1);
+  pid_t pid = fork();
+  GC_atfork_prepare();
+  assert(pid != -1);
+
+  if (pid == 0) {
+    GC_atfork_child();
+    dup2(out_pipe[1], STDOUT_FILENO);
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+
+    JitInstance *jit = jit_init();
+    for (const string &input : inputs)
+      jit_execute(jit, input.c_str());
+    const SeqJIT::Stats &stats = jit->context->getJIT()->getStats();
+    printf("reused %d promoted %d\n", stats.reused > 0, stats.promoted > 0);
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+  }
+
+  GC_atfork_parent();
+  int status = -1;
+  close(out_pipe[1]);
+  assert(waitpid(pid, &status, 0) == pid);
+  read(out_pipe[0], buf.data(), buf.size() - 1);
+  close(out_pipe[0]);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+  return string(buf.data());
+}
+
+TEST(SeqJITTest, ReuseAndPromote) {
+  // sq is called often enough in the fourth input to be promoted when the
+  // fifth one realizes it again; later inputs keep using the promoted code
+  const vector<string> inputs = {
+      "def sq(x: int):\n    return x * x\n",
+      "print sq(3)",
+      "def total(n: int):\n    s = 0\n    for i in range(n):\n"
+      "        s += sq(i)\n    return s\n",
+      "print total(100000)",
+      "print total(10)",
+      "print total(20)",
+      "def sq(x: int):\n    return x + x\n",
+      "print sq(4)"};
+  const vector<string> expects = {
+      "9", "333328333350000", "285", "2470", "8", "reused 1 promoted 1"};
+  EXPECT_EQ(splitLines(runREPL(inputs)), expects);
+}
+
 class ParserTest
     : public testing::TestWithParam<tuple<
           const char * /*code*/, bool /*success*/, const char * /*output*/>> {
@@ -211,8 +291,9 @@ INSTANTIATE_TEST_SUITE_P(
                                      "core/exceptions.seq", "core/formats.seq",
                                      "core/generators.seq", "core/generics.seq",
                                      "core/helloworld.seq", "core/kmers.seq",
-                                     "core/match.seq", "core/proteins.seq",
-                                     "core/range.seq", "core/serialization.seq",
+                                     "core/match.seq", "core/packed.seq",
+                                     "core/proteins.seq", "core/range.seq",
+                                     "core/serialization.seq",
                                      "core/trees.seq"),
                      testing::Values(true, false)),
     getTestNameFromParam);
@@ -223,6 +304,7 @@ INSTANTIATE_TEST_SUITE_P(
                                      "pipeline/prefetch.seq",
                                      "pipeline/revcomp_opt.seq",
                                      "pipeline/canonical_opt.seq",
+                                     "pipeline/sketch_opt.seq",
                                      "pipeline/interalign.seq"),
                      testing::Values(true, false)),
     getTestNameFromParam);
@@ -243,6 +325,26 @@ INSTANTIATE_TEST_SUITE_P(
                      testing::Values(true, false)),
     getTestNameFromParam);
 
+INSTANTIATE_TEST_SUITE_P(
+    ParallelCodegenTests, SeqParallelCodegenTest,
+    testing::Combine(testing::Values("core/helloworld.seq",
+                                     "core/containers.seq",
+                                     "core/exceptions.seq",
+                                     "core/formats.seq",
+                                     "pipeline/parallel.seq"),
+                     testing::Values(true, false)),
+    getTestNameFromParam);
+
+INSTANTIATE_TEST_SUITE_P(
+    TieredTests, SeqTieredTest,
+    testing::Combine(testing::Values("core/tiering.seq",
+                                     "core/containers.seq",
+                                     "core/exceptions.seq",
+                                     "core/kmers.seq",
+                                     "pipeline/parallel.seq"),
+                     testing::Values(false)), // no tiering in debug mode
+    getTestNameFromParam);
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();